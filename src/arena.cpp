@@ -0,0 +1,46 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+static const size_t arena_align = 16;
+
+static char *newChunk(size_t size) {
+    char *chunk = (char *)malloc(size);
+    if (!chunk) {
+        fprintf(stderr, "Arena : cannot allocate %zu bytes\n", size);
+        exit(-1);
+    }
+    return chunk;
+}
+
+Arena *initArena(size_t chunkSize) {
+    Arena *arena = new Arena;
+    arena->chunkSize = chunkSize;
+    arena->used = chunkSize; //first allocation opens the first chunk
+    return arena;
+}
+
+void *arenaAlloc(Arena *arena, size_t size) {
+    size = (size + arena_align - 1) & ~(arena_align - 1);
+
+    if (size > arena->chunkSize / 4) {
+        //big block : own chunk, slipped before the current one so it keeps being filled
+        char *chunk = newChunk(size);
+        arena->chunks.insert(arena->chunks.empty() ? arena->chunks.end() : arena->chunks.end() - 1, chunk);
+        return chunk;
+    }
+
+    if (arena->used + size > arena->chunkSize) {
+        arena->chunks.push_back(newChunk(arena->chunkSize));
+        arena->used = 0;
+    }
+    void *ret = arena->chunks.back() + arena->used;
+    arena->used += size;
+    return ret;
+}
+
+void freeArena(Arena *arena) {
+    for (char *chunk : arena->chunks)
+        free(chunk);
+    delete arena;
+}
@@ -0,0 +1,23 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+#include <vector>
+
+//! \file : chunked bump allocator, every block handed out by an arena is released at once by freeArena
+typedef struct arena_s {
+    std::vector<char*> chunks; //! every block allocated by the arena, the current one is the last
+    size_t chunkSize; //! size of a regular chunk, bigger requests get a chunk of their own
+    size_t used; //! bytes already handed out in the current chunk
+} Arena;
+
+//! create an empty arena, memory is reserved by chunks of chunkSize bytes
+Arena *initArena(size_t chunkSize);
+
+//! get size bytes from the arena, suitably aligned for any type. never freed individually
+void *arenaAlloc(Arena *arena, size_t size);
+
+//! release every block of the arena and the arena itself
+void freeArena(Arena *arena);
+
+#endif
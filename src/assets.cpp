@@ -0,0 +1,248 @@
+#include "assets.h"
+#include "mapfile.h"
+#include "meshio.h"
+#include "pagecache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+
+typedef struct asset_s {
+    std::string key; //! kind of asset followed by its canonical path, a file can be read as several kinds
+    std::string path; //! canonical
+    long long modificationTime; //! of the file when it was read
+    int references;
+    bool stale; //! the file changed since, the asset is not handed out anymore
+    Image *image;
+    Mesh *mesh;
+    MipChain *mipChain;
+} Asset;
+
+typedef struct asset_cache_s {
+    std::mutex lock;
+    std::unordered_map<std::string, Asset*> byKey; //! the current asset of each file and kind
+    std::unordered_map<const void*, Asset*> byData; //! every asset alive, by its image, mesh or mip chain
+    std::unordered_set<std::string> reading; //! keys of the assets being read, without the lock
+    std::condition_variable read; //! one of them is done
+} AssetCache;
+
+//! built on first use : assets may be acquired while globals are initialized
+static AssetCache &assetCache() {
+    static AssetCache cache;
+    return cache;
+}
+
+static const void *assetData(const Asset *asset) {
+    if (asset->image) return asset->image;
+    if (asset->mesh) return asset->mesh;
+    return asset->mipChain;
+}
+
+static void freeAsset(AssetCache &cache, Asset *asset) {
+    cache.byData.erase(assetData(asset));
+    if (asset->image) freeImage(asset->image);
+    if (asset->mesh) freeMesh(asset->mesh);
+    if (asset->mipChain) freeMipChain(asset->mipChain);
+    delete asset;
+}
+
+//! the cached asset of key if it is still up to date, NULL otherwise (a stale one is dropped from the lookup)
+static Asset *findAsset(AssetCache &cache, const std::string &key, long long modificationTime) {
+    auto it = cache.byKey.find(key);
+    if (it == cache.byKey.end()) return NULL;
+    Asset *asset = it->second;
+    if (asset->modificationTime == modificationTime) return asset;
+    cache.byKey.erase(it);
+    asset->stale = true;
+    if (asset->references == 0) freeAsset(cache, asset);
+    return NULL;
+}
+
+static Asset *addAsset(AssetCache &cache, const std::string &key, const std::string &path, long long modificationTime,
+                       Image *image, Mesh *mesh, MipChain *mipChain) {
+    Asset *asset = new Asset;
+    asset->key = key;
+    asset->path = path;
+    asset->modificationTime = modificationTime;
+    asset->references = 0;
+    asset->stale = false;
+    asset->image = image;
+    asset->mesh = mesh;
+    asset->mipChain = mipChain;
+    cache.byKey[key] = asset;
+    cache.byData[assetData(asset)] = asset;
+    return asset;
+}
+
+static bool canonicalPath(const char *filename, std::string *path) {
+    char resolved[PATH_MAX];
+    if (realpath(filename, resolved) == NULL) return false;
+    *path = resolved;
+    return true;
+}
+
+static Image *decodeImage(const std::string &path) {
+    if (isPPMFile(path.c_str()))
+        return loadImagePPM(const_cast<char*>(path.c_str()));
+    return loadImageJPG(const_cast<char*>(path.c_str()));
+}
+
+//! the decoded texels are only needed to build the levels
+static MipChain *decodeMipChain(const std::string &path, TextureCompression compression) {
+    MipChain *mipChain = NULL;
+    ImageBytes bytes;
+    if (loadImageBytes(path.c_str(), &bytes)) {
+        mipChain = initMipChainBytes(bytes.rgb, bytes.width, bytes.height);
+        freeImageBytes(&bytes);
+    } else if (bytes.width > 0) {
+        //more than 8 bits per channel, kept in half floats
+        Image *image = loadImagePPM(const_cast<char*>(path.c_str()));
+        if (image == NULL) return NULL;
+        mipChain = initMipChain(image);
+        freeImage(image);
+    } else {
+        return NULL;
+    }
+    compressMipChain(mipChain, compression);
+    return mipChain;
+}
+
+//! levels of path paged from their cache file, which is written first if it is missing or older than path.
+//! if it cannot be written the levels stay in memory
+static MipChain *pageMipChain(const std::string &path, TextureCompression compression) {
+    static const char *const suffixes[] = {"", ".bc1", ".bc5", ".oct", ".alpha"};
+    std::string cache = path + suffixes[compression] + TEXTURE_CACHE_SUFFIX;
+    long long cacheTime = fileModificationTime(cache.c_str());
+    if (cacheTime > 0 && cacheTime >= fileModificationTime(path.c_str())) {
+        MipChain *paged = loadMipChainCache(cache.c_str());
+        if (paged != NULL) return paged;
+    }
+    MipChain *mipChain = decodeMipChain(path, compression);
+    if (mipChain == NULL) return NULL;
+    MipChain *paged = writeMipChainCache(cache.c_str(), mipChain) ? loadMipChainCache(cache.c_str()) : NULL;
+    if (paged == NULL) {
+        fprintf(stderr, "Cannot write texture cache %s, the texture stays in memory\n", cache.c_str());
+        return mipChain;
+    }
+    freeMipChain(mipChain);
+    return paged;
+}
+
+//! the up to date asset of key, or the one read sets (image, mesh or mip chain) if there is none. it is read
+//! without the lock : the same asset is not read twice at once, other ones can be read meanwhile (see queueTexture)
+template <typename Read>
+static Asset *acquireAsset(const std::string &key, const std::string &path, long long modificationTime, Read read) {
+    AssetCache &cache = assetCache();
+    std::unique_lock<std::mutex> guard(cache.lock);
+    while (cache.reading.count(key)) cache.read.wait(guard);
+    Asset *asset = findAsset(cache, key, modificationTime);
+    if (asset == NULL) {
+        Image *image = NULL;
+        Mesh *mesh = NULL;
+        MipChain *mipChain = NULL;
+        cache.reading.insert(key);
+        guard.unlock();
+        read(&image, &mesh, &mipChain);
+        guard.lock();
+        cache.reading.erase(key);
+        cache.read.notify_all();
+        if (image == NULL && mesh == NULL && mipChain == NULL) return NULL;
+        asset = addAsset(cache, key, path, modificationTime, image, mesh, mipChain);
+    }
+    ++asset->references;
+    return asset;
+}
+
+Image *acquireImage(const char *filename) {
+    std::string path;
+    if (!canonicalPath(filename, &path)) return NULL;
+    long long modificationTime = fileModificationTime(path.c_str());
+
+    Asset *asset = acquireAsset("image:" + path, path, modificationTime, [&](Image **image, Mesh **, MipChain **) {
+        *image = decodeImage(path);
+    });
+    return asset ? asset->image : NULL;
+}
+
+MipChain *acquireMipChain(const char *filename, TextureCompression compression) {
+    std::string path;
+    if (!canonicalPath(filename, &path)) {
+        fprintf(stderr, "Cannot open file %s...\n", filename);
+        return NULL;
+    }
+    long long modificationTime = fileModificationTime(path.c_str());
+
+    static const char *const kinds[] = {"texture:", "color blocks:", "normal blocks:", "unit normals:", "roughness:"};
+    Asset *asset = acquireAsset(kinds[compression] + path, path, modificationTime, [&](Image **, Mesh **, MipChain **mipChain) {
+        *mipChain = textureCacheCapacity() > 0 ? pageMipChain(path, compression) : decodeMipChain(path, compression);
+    });
+    return asset ? asset->mipChain : NULL;
+}
+
+Mesh *acquireMesh(const char *filename) {
+    std::string path;
+    if (!canonicalPath(filename, &path)) {
+        fprintf(stderr, "Cannot open file %s...\n", filename);
+        return NULL;
+    }
+    long long modificationTime = fileModificationTime(path.c_str());
+
+    //parsed and simplified while the textures queued before it are read
+    Asset *asset = acquireAsset("mesh:" + path, path, modificationTime, [&](Image **, Mesh **mesh, MipChain **) {
+        *mesh = initMesh();
+        if (!loadMesh(path.c_str(), *mesh)) {
+            freeMesh(*mesh);
+            *mesh = NULL;
+        }
+    });
+    return asset ? asset->mesh : NULL;
+}
+
+static void releaseAsset(const void *data) {
+    if (data == NULL) return;
+    AssetCache &cache = assetCache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    auto it = cache.byData.find(data);
+    if (it == cache.byData.end()) {
+        fprintf(stderr, "Releasing an asset that was not acquired\n");
+        return;
+    }
+    Asset *asset = it->second;
+    if (--asset->references == 0 && asset->stale) freeAsset(cache, asset);
+}
+
+void releaseImage(Image *img) {
+    releaseAsset(img);
+}
+
+void releaseMipChain(MipChain *mipChain) {
+    releaseAsset(mipChain);
+}
+
+void releaseMesh(Mesh *mesh) {
+    releaseAsset(mesh);
+}
+
+void purgeAssets() {
+    AssetCache &cache = assetCache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    std::vector<Asset*> unused;
+    for (auto &entry : cache.byData) {
+        Asset *asset = entry.second;
+        if (!asset->stale && asset->modificationTime != fileModificationTime(asset->path.c_str())) {
+            cache.byKey.erase(asset->key);
+            asset->stale = true;
+        }
+        if (asset->references == 0) unused.push_back(asset);
+    }
+    for (Asset *asset : unused) {
+        if (!asset->stale) cache.byKey.erase(asset->key);
+        freeAsset(cache, asset);
+    }
+}
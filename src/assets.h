@@ -0,0 +1,28 @@
+#ifndef __ASSETS_H__
+#define __ASSETS_H__
+
+#include "image.h"
+#include "mesh.h"
+#include "texture.h"
+
+//! \file : process-wide cache of the assets read from files, keyed by canonical path and modification time.
+//! each file is decoded once and shared, every acquire must be matched by a release. assets nobody
+//! holds anymore stay cached until purgeAssets, so that scenes built again and again do not decode them again
+
+//! image of filename (PPM, or any format stb_image reads), NULL if it cannot be read
+Image *acquireImage(const char *filename);
+void releaseImage(Image *img);
+
+//! levels of the texture of filename (see initMipChain), compressed (see compressMipChain), NULL if it cannot be read.
+//! when the texture cache has a capacity (see setTextureCacheCapacity) they are paged from a cache file next to filename
+MipChain *acquireMipChain(const char *filename, TextureCompression compression);
+void releaseMipChain(MipChain *mipChain);
+
+//! mesh of filename, see loadMesh. NULL if it cannot be read
+Mesh *acquireMesh(const char *filename);
+void releaseMesh(Mesh *mesh);
+
+//! free the assets that are not held anymore, and the ones whose file changed since they were read
+void purgeAssets();
+
+#endif
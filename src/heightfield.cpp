@@ -0,0 +1,51 @@
+#include "heightfield.h"
+
+Heightfield *initHeightfieldData(Arena *arena, Image *heights) {
+    Heightfield *hf = (Heightfield *)arenaAlloc(arena, sizeof(Heightfield));
+    hf->heights = heights;
+    hf->cellsX = heights->width - 1;
+    hf->cellsZ = heights->height - 1;
+
+    //level 0 : bounds of the four corners of each cell
+    size_t w = hf->cellsX, h = hf->cellsZ;
+    vec2 *level = (vec2 *)arenaAlloc(arena, sizeof(vec2) * w * h);
+    for (size_t z = 0 ; z < h ; ++z) {
+        for (size_t x = 0 ; x < w ; ++x) {
+            float h00 = heightfieldSample(hf, x, z), h10 = heightfieldSample(hf, x+1, z);
+            float h01 = heightfieldSample(hf, x, z+1), h11 = heightfieldSample(hf, x+1, z+1);
+            level[z * w + x] = vec2(fminf(fminf(h00, h10), fminf(h01, h11)),
+                                    fmaxf(fmaxf(h00, h10), fmaxf(h01, h11)));
+        }
+    }
+    hf->levelCount = 1;
+    hf->levelWidth[0] = w;
+    hf->levelHeight[0] = h;
+    hf->bounds[0] = level;
+
+    //next levels merge 2x2 nodes, the last row or column may have a single child
+    while ((w > 1 || h > 1) && hf->levelCount < HEIGHTFIELD_MAX_LEVELS) {
+        const vec2 *child = level;
+        size_t cw = w, ch = h;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        level = (vec2 *)arenaAlloc(arena, sizeof(vec2) * w * h);
+        for (size_t z = 0 ; z < h ; ++z) {
+            for (size_t x = 0 ; x < w ; ++x) {
+                vec2 b = child[2*z * cw + 2*x];
+                for (size_t dz = 0 ; dz < 2 ; ++dz) {
+                    for (size_t dx = 0 ; dx < 2 ; ++dx) {
+                        if (2*x+dx >= cw || 2*z+dz >= ch) continue;
+                        vec2 c = child[(2*z+dz) * cw + 2*x+dx];
+                        b = vec2(fminf(b.x, c.x), fmaxf(b.y, c.y));
+                    }
+                }
+                level[z * w + x] = b;
+            }
+        }
+        hf->levelWidth[hf->levelCount] = w;
+        hf->levelHeight[hf->levelCount] = h;
+        hf->bounds[hf->levelCount] = level;
+        ++hf->levelCount;
+    }
+    return hf;
+}
@@ -0,0 +1,35 @@
+#ifndef __HEIGHTFIELD_H__
+#define __HEIGHTFIELD_H__
+
+#include "defines.h"
+#include "image.h"
+#include "arena.h"
+
+//! \file : heightfield backed by an image, with a min-max pyramid of its cells to skip empty space
+
+#define HEIGHTFIELD_MAX_LEVELS 32
+
+//! samples are the pixels of the image, a cell is the bilinear patch between four neighbour samples.
+//! node (x,z) of level k covers the cells [x*2^k, (x+1)*2^k[ x [z*2^k, (z+1)*2^k[, level 0 being the cells
+typedef struct heightfield_s {
+    Image *heights; //! height of the samples is the mean of the channels, in [0,1]. not owned
+    size_t cellsX, cellsZ; //! number of cells along x (image width) and z (image height)
+    int levelCount; //! the last level has a single node
+    size_t levelWidth[HEIGHTFIELD_MAX_LEVELS];
+    size_t levelHeight[HEIGHTFIELD_MAX_LEVELS];
+    vec2 *bounds[HEIGHTFIELD_MAX_LEVELS]; //! (min, max) height of every node of the level
+} Heightfield;
+
+inline float heightfieldSample(const Heightfield *hf, size_t x, size_t z) {
+    const color3 &c = hf->heights->data[z * hf->heights->width + x];
+    return (c.r + c.g + c.b) * (1.f/3.f);
+}
+
+inline vec2 heightfieldNode(const Heightfield *hf, int level, size_t x, size_t z) {
+    return hf->bounds[level][z * hf->levelWidth[level] + x];
+}
+
+//! build the min-max pyramid of heights (at least 2x2 pixels), everything is allocated in arena
+Heightfield *initHeightfieldData(Arena *arena, Image *heights);
+
+#endif
@@ -2,6 +2,8 @@
 #include <lodepng.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <algorithm>
 
 #define SAVE_PNG
 #define STB_IMAGE_IMPLEMENTATION
@@ -24,31 +26,29 @@ void freeImage(Image *img) {
     free(img);
 }
 
-void saveImage(Image *img, char *basename) {
+void saveImage(Image *img, char *basename, int level) {
 #ifdef SAVE_PNG
   char filename[256+4];
   strcpy(filename, basename);
   strcat(filename, ".png");
 
-  size_t cpt = 0;
   unsigned char *image = new unsigned char [img->width*img->height*3];
-  // write image to file
-  for(unsigned y = 0; y < img->height; y++) {
+  // the rows go from the top, the image is stored from the bottom
+  #pragma omp parallel for
+  for(size_t y = 0; y < img->height; y++) {
     color3 *ptr = getPixelPtr(img, 0, img->height-y-1);
+    unsigned char *row = image + y*img->width*3;
     for(unsigned x = 0; x < img->width; x++) {
       ivec3 c = clamp(ivec3(255.f**ptr), 0, 255);
-      image[cpt++] = c.x;
-      image[cpt++] = c.y;
-      image[cpt++] = c.z;
+      row[3*x] = c.x;
+      row[3*x+1] = c.y;
+      row[3*x+2] = c.z;
       ++ptr;
     }
   }
 
-  /*Encode the image*/
-  unsigned error = lodepng_encode24_file(filename, image, img->width, img->height);
+  writePNG(filename, image, img->width, img->height, level);
   delete [] image;
-  /*if there's an error, display it*/
-  if(error) printf("error %u: %s\n", error, lodepng_error_text(error));
 #else
     // save the image to basename.ppm
     {
@@ -106,37 +106,130 @@ Image *loadImagePNG(char *filename){
 	return image;
 }
 
-Image * loadImagePPM(char *filename){
-	int i, width,height,max_value;
-	char format[8];
-	Image * image;
-	FILE * f = fopen(filename,"r");
-	if (!f){
-		fprintf(stderr,"Cannot open file %s...\n",filename);
-		exit(-1);
-	}
-	fscanf(f,"%s\n",format);
-	assert( (format[0]=='P' && format[1]=='3'));  // check P3 format
-	while(fgetc(f)=='#') // commentaire
-	{
-		while(fgetc(f) != '\n'); // aller jusqu'a la fin de la ligne
-	}
-	fseek( f, -1, SEEK_CUR);
-	fscanf(f,"%d %d\n", &width, &height);
-	fscanf(f,"%d\n", &max_value);
-	image = initImage(width, height);
-	assert(image != NULL);
-	assert(image->data != NULL);
-
-	for(i=0 ; i<width*height ; i++){
-		int r,g,b;
-		fscanf(f,"%d %d %d", &r, &g, &b);
-		image->data[i].r = float(r)/255.f;
-		image->data[i].g = float(g)/255.f;
-		image->data[i].b = float(b)/255.f;
-	}
-	fclose(f);
-	return image;
+/* PPM / PGM */
+
+//! what the header of a PPM / PGM file says, the samples follow it
+typedef struct ppm_header_s {
+    bool binary; //! P5 and P6
+    size_t channels; //! 3 for PPM, 1 for PGM
+    size_t width, height;
+    size_t maxValue;
+    const char *samples, *end;
+} PPMHeader;
+
+static const size_t ppm_max_size = size_t(1) << 20;
+//! samples are 16 bit at most
+static const size_t ppm_max_value = 65535;
+
+bool isPPMFile(const char *filename) {
+    size_t length = strlen(filename);
+    return length >= 4 && (strcasecmp(filename + length - 4, ".ppm") == 0 || strcasecmp(filename + length - 4, ".pgm") == 0);
+}
+
+//! skip blanks and comments, which run to the end of their line
+static const char *skipPPMBlanks(const char *s, const char *end) {
+    while (s < end) {
+        if (*s == '#') {
+            while (s < end && *s != '\n') ++s;
+        } else if (*s == ' ' || (*s >= '\t' && *s <= '\r')) {
+            ++s;
+        } else {
+            break;
+        }
+    }
+    return s;
+}
+
+//! the decimal number at s, NULL if there is none or it is above limit
+static const char *readPPMNumber(const char *s, const char *end, size_t limit, size_t *value) {
+    if (s == end || unsigned(*s - '0') > 9) return NULL;
+    size_t v = 0;
+    do {
+        v = v * 10 + size_t(*s++ - '0');
+        if (v > limit) return NULL;
+    } while (s < end && unsigned(*s - '0') <= 9);
+    *value = v;
+    return s;
+}
+
+//! false (with a message) if file is not a PPM / PGM file or is too short for its texels
+static bool readPPMHeader(const MappedFile &file, const char *filename, PPMHeader *header) {
+    const char *s = file.data, *end = file.data + file.size;
+    bool ok = file.size > 2 && s[0] == 'P' && (s[1] == '2' || s[1] == '3' || s[1] == '5' || s[1] == '6');
+    if (ok) {
+        header->binary = s[1] >= '5';
+        header->channels = (s[1] == '3' || s[1] == '6') ? 3 : 1;
+        s = readPPMNumber(skipPPMBlanks(s + 2, end), end, ppm_max_size, &header->width);
+        if (s) s = readPPMNumber(skipPPMBlanks(s, end), end, ppm_max_size, &header->height);
+        if (s) s = readPPMNumber(skipPPMBlanks(s, end), end, ppm_max_value, &header->maxValue);
+        ok = s != NULL && header->width > 0 && header->height > 0 && header->maxValue > 0;
+    }
+    if (ok && !header->binary) {
+        //every ASCII sample takes at least a digit and a blank : the texels are not allocated for a header
+        //that announces more of them than the file holds
+        size_t samples = header->width * header->height * header->channels;
+        ok = samples <= (size_t(end - s) + 1) / 2;
+    } else if (ok) {
+        //a single blank ends the header, the samples are 1 or 2 bytes (most significant first)
+        size_t bytes = header->width * header->height * header->channels * (header->maxValue > 255 ? 2 : 1);
+        ok = s < end && (*s == ' ' || (*s >= '\t' && *s <= '\r')) && size_t(end - s - 1) >= bytes;
+        ++s;
+    }
+    if (!ok) {
+        fprintf(stderr, "Bad PPM file %s...\n", filename);
+        return false;
+    }
+    header->samples = s;
+    header->end = end;
+    return true;
+}
+
+//! give the samples of header, channels per texel row after row, to store(index, value). values above
+//! the maximum are clamped. false if a sample of an ASCII file is missing, bad or above any PPM maximum
+template <class Store>
+static bool readPPMSamples(const PPMHeader &header, Store store) {
+    size_t count = header.width * header.height * header.channels;
+    const unsigned char *bytes = (const unsigned char *)header.samples;
+    if (header.binary && header.maxValue > 255) {
+        #pragma omp parallel for if (count > 65536)
+        for (size_t i = 0; i < count; ++i) store(i, std::min(size_t(bytes[2*i]) << 8 | bytes[2*i+1], header.maxValue));
+    } else if (header.binary) {
+        #pragma omp parallel for if (count > 65536)
+        for (size_t i = 0; i < count; ++i) store(i, std::min(size_t(bytes[i]), header.maxValue));
+    } else {
+        const char *s = header.samples;
+        for (size_t i = 0; i < count; ++i) {
+            size_t value;
+            s = readPPMNumber(skipPPMBlanks(s, header.end), header.end, ppm_max_value, &value);
+            if (s == NULL) return false;
+            store(i, std::min(value, header.maxValue));
+        }
+    }
+    return true;
+}
+
+Image *loadImagePPM(char *filename) {
+    MappedFile file;
+    if (!mapFile(filename, &file)) return NULL;
+    PPMHeader header;
+    Image *image = NULL;
+    if (readPPMHeader(file, filename, &header)) {
+        image = initImage(header.width, header.height);
+        float maxValue = float(header.maxValue);
+        color3 *data = image->data;
+        bool ok;
+        if (header.channels == 3)
+            ok = readPPMSamples(header, [data, maxValue](size_t i, size_t value) { data[i / 3][int(i % 3)] = float(value) / maxValue; });
+        else
+            ok = readPPMSamples(header, [data, maxValue](size_t i, size_t value) { data[i] = color3(float(value) / maxValue); });
+        if (!ok) {
+            fprintf(stderr, "Bad PPM file %s...\n", filename);
+            freeImage(image);
+            image = NULL;
+        }
+    }
+    unmapFile(&file);
+    return image;
 }
 
 Image * loadImageJPG(char *filename){
@@ -158,3 +251,60 @@ Image * loadImageJPG(char *filename){
 
 	return img;
 }
+
+bool loadImageBytes(const char *filename, ImageBytes *bytes) {
+	bytes->rgb = NULL;
+	bytes->width = bytes->height = 0;
+	bytes->file.data = NULL;
+	bytes->file.size = 0;
+	bytes->buffer = NULL;
+	if (!isPPMFile(filename)) {
+		int w, h, bpp;
+		bytes->buffer = stbi_load(filename, &w, &h, &bpp, 3);
+		if (bytes->buffer == NULL) return false;
+		bytes->rgb = bytes->buffer;
+		bytes->width = size_t(w);
+		bytes->height = size_t(h);
+		return true;
+	}
+
+	if (!mapFile(filename, &bytes->file)) return false;
+	PPMHeader header;
+	if (!readPPMHeader(bytes->file, filename, &header)) {
+		unmapFile(&bytes->file);
+		return false;
+	}
+	bytes->width = header.width;
+	bytes->height = header.height;
+	if (header.maxValue > 255) {
+		unmapFile(&bytes->file);
+		return false;
+	}
+	if (header.binary && header.channels == 3 && header.maxValue == 255) {
+		bytes->rgb = (const unsigned char *)header.samples;
+		return true;
+	}
+
+	//rescaled to 8 bits, grey levels fill the 3 channels
+	unsigned char *rgb = (unsigned char *)STBI_MALLOC(header.width * header.height * 3);
+	size_t maxValue = header.maxValue, channels = header.channels;
+	bool ok = readPPMSamples(header, [rgb, maxValue, channels](size_t i, size_t value) {
+		unsigned char v = (unsigned char)((value * 255 + maxValue / 2) / maxValue);
+		if (channels == 3) rgb[i] = v;
+		else rgb[3*i] = rgb[3*i+1] = rgb[3*i+2] = v;
+	});
+	unmapFile(&bytes->file);
+	if (!ok) {
+		fprintf(stderr, "Bad PPM file %s...\n", filename);
+		stbi_image_free(rgb);
+		return false;
+	}
+	bytes->rgb = bytes->buffer = rgb;
+	return true;
+}
+
+void freeImageBytes(ImageBytes *bytes) {
+	unmapFile(&bytes->file);
+	stbi_image_free(bytes->buffer);
+	bytes->rgb = bytes->buffer = NULL;
+}
@@ -2,6 +2,8 @@
 #define __IMAGE_H__
 
 #include "defines.h"
+#include "mapfile.h"
+#include "pngwrite.h"
 
 typedef struct image_s {
     size_t width;
@@ -12,10 +14,29 @@ typedef struct image_s {
 color3 *getPixelPtr(Image *img, size_t x, size_t y);
 Image *initImage(size_t width, size_t height);
 void freeImage(Image *img);
-void saveImage(Image *img, char *basename);
+//! to basename.png, deflated at level (see pngwrite.h)
+void saveImage(Image *img, char *basename, int level = png_default);
 Image *loadImagePNG(char *filename);
+//! .ppm or .pgm file name
+bool isPPMFile(const char *filename);
+//! PPM (P3, P6) or PGM (P2, P5) file of up to 16 bits per channel, grey levels fill the 3 channels.
+//! NULL (with a message) if it cannot be read
 Image *loadImagePPM(char *filename);
 Image *loadImageJPG(char *filename);
 
+//! 8 bit RGB texels of an image file, row after row
+typedef struct image_bytes_s {
+    const unsigned char *rgb;
+    size_t width, height;
+    MappedFile file; //! binary 8 bit PPM files are read in place : rgb points in their mapping
+    unsigned char *buffer; //! decoded texels otherwise
+} ImageBytes;
+
+//! texels of a PPM / PGM file, or of a JPG file (or any format stb_image reads). false if it cannot be read,
+//! or for a PPM / PGM file of more than 8 bits per channel (see loadImagePPM) : only width and height are
+//! then set. freed by freeImageBytes
+bool loadImageBytes(const char *filename, ImageBytes *bytes);
+void freeImageBytes(ImageBytes *bytes);
+
 
 #endif
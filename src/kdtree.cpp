@@ -74,7 +74,7 @@ void subdivide(Scene *scene, KdTree *tree, KdTreeNode *node) {
 
 }
 
-bool traverse(Scene * scene, KdTree * tree, std::stack<StackNode> *stack, StackNode currentNode, Ray * ray, Intersection *intersection) {
+bool traverse(Scene * scene, KdTree * tree, std::stack<StackNode> *stack, StackNode currentNode, Ray * ray, Hit *hit) {
 
     //! \todo traverse kdtree to find intersection
 
@@ -105,7 +105,7 @@ static bool intersectAabb(Ray *theRay,  vec3 min, vec3 max) {
 }
 
 
-bool intersectKdTree(Scene *scene, KdTree *tree, Ray *ray, Intersection *intersection) {
+bool intersectKdTree(Scene *scene, KdTree *tree, Ray *ray, Hit *hit) {
     bool hasIntersection = false;
 
     //!\todo call vanilla intersection on non kdtree object, then traverse the tree to compute other intersections
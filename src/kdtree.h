@@ -6,6 +6,6 @@
 
 typedef struct s_kdtree KdTree;
 
-bool intersectKdTree(Scene *scene, KdTree *tree, Ray *ray, Intersection *intersection);
+bool intersectKdTree(Scene *scene, KdTree *tree, Ray *ray, Hit *hit);
 KdTree*  initKdTree(Scene *scene);
 #endif
@@ -3,6 +3,9 @@
 #include "ray.h"
 #include "raytracer.h"
 #include "scene.h"
+#include "assets.h"
+#include "texture.h"
+#include "pagecache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +15,8 @@
 #define WIDTH 800
 #define HEIGHT 600
 
+//! the textures of the library are held for the whole run, each one is read when first sampled.
+//! color maps and the normal maps that store unit normals are kept compressed
 Material mat_lib[] = {
     /* 0 nickel */
     {2.4449, 0.0681, {1.0, 0.882, 0.786}, {0.014, 0.012, 0.012}, 0.f, nullptr, nullptr, nullptr, nullptr, false, false, false, false},
@@ -42,7 +47,7 @@ Material mat_lib[] = {
 
     /* 9 obsidian diffuse only (for tests) */
     {1.5, 0.05f, {0.f, 0.f, 0.f}, {1.f, 1.f, 1.f}, 0.f
-            , loadImageJPG(static_cast<char*>("../../resources/obsidianDiffuse.jpg"))
+            , initTexture("../../resources/obsidianDiffuse.jpg", TEXTURE_COLOR_BLOCKS)
             , nullptr
             , nullptr
             , nullptr
@@ -52,37 +57,37 @@ Material mat_lib[] = {
     {1.5, 0.056, {1.f, 0.9f, 0.86f}, {1.0, 1.056, 1.146}, 1.f, nullptr, nullptr, nullptr, nullptr, false, false, false, false},
 
     /* 11 water */
-    {1.33, 0.06, {1.f, 0.9f, 0.86f}, {0.f, 0.f, 0.f}, 1.f, nullptr, loadImageJPG(static_cast<char*>("../../resources/waterNormal.jpg")), nullptr, nullptr, false, true, false, false},
+    {1.33, 0.06, {1.f, 0.9f, 0.86f}, {0.f, 0.f, 0.f}, 1.f, nullptr, initTexture("../../resources/waterNormal.jpg", TEXTURE_NORMAL_BLOCKS), nullptr, nullptr, false, true, false, false},
 
     /* 12 obsidian */
     {1.5, 0.05f, {0.f, 0.f, 0.f}, {0.f, 0.f, 0.f}, 0.f
-            , loadImageJPG(static_cast<char*>("../../resources/obsidianDiffuse.jpg"))
-            , loadImageJPG(static_cast<char*>("../../resources/obsidianNormal.jpg"))
-            , loadImageJPG(static_cast<char*>("../../resources/obsidianSpec.jpg"))
-            , loadImageJPG(static_cast<char*>("../../resources/obsidianRough.jpg"))
+            , initTexture("../../resources/obsidianDiffuse.jpg", TEXTURE_COLOR_BLOCKS)
+            , initTexture("../../resources/obsidianNormal.jpg", TEXTURE_UNIT_NORMALS)
+            , initTexture("../../resources/obsidianSpec.jpg")
+            , initTexture("../../resources/obsidianRough.jpg", TEXTURE_ROUGHNESS)
             , true, true, true, true},
 
     /* 13 Pavement1 */
     {1.2, 0.3f, {0.f, 0.f, 0.f}, {0.f, 0.f, 0.f}, 0.f
-            , loadImageJPG(static_cast<char*>("../../resources/pavement1Diffuse.jpg"))
-            , loadImageJPG(static_cast<char*>("../../resources/pavement1Normal.jpg"))
-            , loadImageJPG(static_cast<char*>("../../resources/pavement1Spec.jpg"))
-            , loadImageJPG(static_cast<char*>("../../resources/pavement1Rough.jpg"))
+            , initTexture("../../resources/pavement1Diffuse.jpg", TEXTURE_COLOR_BLOCKS)
+            , initTexture("../../resources/pavement1Normal.jpg", TEXTURE_UNIT_NORMALS)
+            , initTexture("../../resources/pavement1Spec.jpg")
+            , initTexture("../../resources/pavement1Rough.jpg", TEXTURE_ROUGHNESS)
             , true, true, true, true},
 
     /* 14 Pavement2 */
     {1.1, 0.3f, {0.f, 0.f, 0.f}, {0.f, 0.f, 0.f}, 0.f
-            , loadImageJPG(static_cast<char*>("../../resources/pavement2Diffuse.jpg"))
-            , loadImageJPG(static_cast<char*>("../../resources/pavement2Normal.jpg"))
-            , loadImageJPG(static_cast<char*>("../../resources/pavement2Spec.jpg"))
-            , loadImageJPG(static_cast<char*>("../../resources/pavement2Rough.jpg"))
+            , initTexture("../../resources/pavement2Diffuse.jpg", TEXTURE_COLOR_BLOCKS)
+            , initTexture("../../resources/pavement2Normal.jpg", TEXTURE_UNIT_NORMALS)
+            , initTexture("../../resources/pavement2Spec.jpg")
+            , initTexture("../../resources/pavement2Rough.jpg", TEXTURE_ROUGHNESS)
             , true, true, true, true},
 
     /* 15 earth */
     {1.25, 0.3f, {0.f, 0.f, 0.f}, {0.f, 0.f, 0.f}, 0.f
-            , loadImageJPG(static_cast<char*>("../../resources/earthDiffuse.jpg"))
-            , loadImageJPG(static_cast<char*>("../../resources/earthNormal.jpg"))
-            , loadImageJPG(static_cast<char*>("../../resources/earthSpec.jpg"))
+            , initTexture("../../resources/earthDiffuse.jpg", TEXTURE_COLOR_BLOCKS)
+            , initTexture("../../resources/earthNormal.jpg", TEXTURE_NORMAL_BLOCKS)
+            , initTexture("../../resources/earthSpec.jpg")
             , nullptr
             , true, true, true, false}};
 
@@ -389,7 +394,7 @@ Scene *initScene1bis(float ior, float t) {
 
 
     mat.hasImgTexture = true;
-    mat.image_texture = loadImageJPG(static_cast<char*>("../../resources/chess2.jpg"));
+    mat.image_texture = sceneTexture(scene, "../../resources/chess2.jpg");
   mat.diffuseColor = color3(0.8, 0.06, .014);
   mat.specularColor = color3(1., 1., 1.);
   mat.IOR = 1.001;
@@ -475,6 +480,54 @@ Scene *comparingTexture(bool allTextures){
     return scene;
 }
 
+Scene *initPrimitivesScene() {
+    Scene *scene = initScene();
+    setCamera(scene, point3(4.5, 2, 4.5), vec3(0, 0.5, 0), vec3(0, 1, 0), 50,
+              (float)WIDTH / (float)HEIGHT);
+    setSkyColor(scene, color3(0.2, 0.2, 0.7));
+
+    addObject(scene, initPlane(vec3(0,1,0), 0.f, mat_lib[4]));
+    initCube(scene, mat_lib[7], .5f, vec3(-1.f,.5f,-1.f));
+    addObject(scene, initOrientedBox(point3(1.5f,.4f,-1.f), vec3(.6f,.4f,.3f), vec3(1,0,1), vec3(0,1,0), mat_lib[2]));
+    addObject(scene, initCylinder(point3(-1.f,0.f,1.5f), vec3(0,1,0), .4f, 1.2f, mat_lib[0]));
+    addObject(scene, initCylinder(point3(1.f,.3f,1.f), vec3(1,0,-1), .3f, 1.f, mat_lib[8]));
+    addObject(scene, initDisk(point3(0.f,1.5f,0.f), vec3(1,1,1), .6f, mat_lib[6]));
+
+    addLight(scene, initLight(point3(2.5,4,-2.5), color3(1,1,1)));
+    addLight(scene, initLight(point3(5,5,5), color3(1,1,1)));
+    return scene;
+}
+
+//! procedural height map : rolling hills, or small waves at higher frequencies
+Image *makeHeightmap(size_t size, float frequency, float phase) {
+    Image *img = initImage(size, size);
+    for (size_t y = 0 ; y < size ; ++y) {
+        for (size_t x = 0 ; x < size ; ++x) {
+            float u = float(x) / float(size - 1), v = float(y) / float(size - 1);
+            float h = 0.5f + 0.25f * sinf(frequency * u * 6.28f + phase) * cosf(frequency * v * 5.1f)
+                    + 0.15f * sinf(frequency * 3.1f * (u + v) + 2.f * phase);
+            *getPixelPtr(img, x, y) = color3(clamp(h, 0.f, 1.f));
+        }
+    }
+    return img;
+}
+
+Scene *initTerrainScene() {
+    Scene *scene = initScene();
+    setCamera(scene, point3(4.5, 2.5, 4.5), vec3(0, 0.2, 0), vec3(0, 1, 0), 60,
+              (float)WIDTH / (float)HEIGHT);
+    setSkyColor(scene, color3(0.2, 0.2, 0.7));
+
+    //the height maps are kept for the whole run, as textures are
+    initHeightfield(scene, makeHeightmap(256, 2.f, 0.f), vec3(-4.f, -0.6f, -4.f), vec3(8.f, 1.4f, 8.f), mat_lib[8]);
+    initHeightfield(scene, makeHeightmap(512, 24.f, 1.f), vec3(-4.f, 0.1f, -4.f), vec3(8.f, 0.05f, 8.f), mat_lib[2]);
+    addObject(scene, initSphere(point3(0.5,0.8,0.5), .4f, mat_lib[0]));
+
+    addLight(scene, initLight(point3(2.5,4,-2.5), color3(1,1,1)));
+    addLight(scene, initLight(point3(5,5,5), color3(1,1,1)));
+    return scene;
+}
+
 Scene *initWolfScene() {
     Scene *scene = initScene();
     setCamera(scene, point3(4, 2, 0), vec3(0, 0.4, 0), vec3(0, 1, 0), 60,
@@ -498,7 +551,7 @@ Scene *initWolfScene() {
     mat.roughness = 0.06f;
     initComplex(scene, "../../resources/Deer.obj", mat, 1.f/250.f, vec3(-2.f,0.f,-.5f), pi<float>()/3.f);
 
-    mat.hasImgTexture = ((mat.image_texture = loadImageJPG(static_cast<char*>("../../resources/chess2.jpg"))) == NULL);
+    mat.hasImgTexture = ((mat.image_texture = sceneTexture(scene, "../../resources/chess2.jpg")) == NULL);
     mat.diffuseColor = color3(0.6f);
     addObject(scene, initPlane(vec3(0, 1, 0), 0, mat));
 
@@ -526,12 +579,12 @@ void registerStudy(char *basename){
             strcpy(countedname, name.c_str());
 
             printf("save image to %s\n", countedname);
-            saveImage(img, countedname);
+            saveImage(img, countedname, png_fast);
+            freeScene(scene);
             count+=1;
         }
     }
     freeImage(img);
-    freeScene(scene);
 }
 
 int main(int argc, char *argv[]) {
@@ -539,19 +592,23 @@ int main(int argc, char *argv[]) {
 
   char basename[256];
 
-  if (argc < 2 || argc > 3) {
-    printf("usage : %s filename i\n", argv[0]);
+  if (argc < 2 || argc > 4) {
+    printf("usage : %s filename i mb\n", argv[0]);
     printf("        filename : where to save the result, whithout extention\n");
     printf("        i : scenen number, optional\n");
+    printf("        mb : size of the texture cache in MB, optional. textures are then paged from a tiled copy on disk\n");
     exit(0);
   }
 
   strncpy(basename, argv[1], 255);
 
   int scene_id = 0;
-  if (argc == 3) {
+  if (argc >= 3) {
     scene_id = atoi(argv[2]);
   }
+  if (argc == 4) {
+    setTextureCacheCapacity(size_t(atol(argv[3])) << 20);
+  }
 
     Image *img = initImage(WIDTH, HEIGHT);
       Scene *scene = NULL;
@@ -589,6 +646,12 @@ int main(int argc, char *argv[]) {
           case 10:
               scene = testTriSphereScene();
               break;
+          case 11:
+              scene = initPrimitivesScene();
+              break;
+          case 12:
+              scene = initTerrainScene();
+              break;
           default:
               scene = initScene0();
               break;
@@ -597,13 +660,21 @@ int main(int argc, char *argv[]) {
   printf("render scene %d\n", scene_id);
 
   renderImage(img, scene);
+  if (textureCacheCapacity() > 0) {
+    TextureCacheStats stats = textureCacheStats();
+    printf("texture cache : %.1f of %.1f MB, %.2f%% hits, %.1f MB read\n", stats.size / 1048576., stats.capacity / 1048576.,
+           stats.lookups ? 100. * (stats.lookups - stats.misses) / stats.lookups : 100., stats.bytesRead / 1048576.);
+  }
   freeScene(scene);
   scene = NULL;
+  //textures of the material library that were queued but never sampled
+  cancelTextureLoads();
 
   printf("save image to %s\n", basename);
   saveImage(img, basename);
   freeImage(img);
   img = NULL;
+  purgeAssets();
   printf("done. Goodbye\n");
 
   return 0;
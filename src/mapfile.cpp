@@ -0,0 +1,62 @@
+#include "mapfile.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool mapFile(const char *filename, MappedFile *file) {
+    file->data = NULL;
+    file->size = 0;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open file %s...\n", filename);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Cannot stat file %s...\n", filename);
+        close(fd);
+        return false;
+    }
+    file->size = size_t(st.st_size);
+    if (file->size > 0) {
+        void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "Cannot map file %s...\n", filename);
+            close(fd);
+            file->size = 0;
+            return false;
+        }
+        file->data = (const char *)data;
+    }
+    //the mapping stays valid once the descriptor is closed
+    close(fd);
+    return true;
+}
+
+void unmapFile(MappedFile *file) {
+    if (file->data) munmap((void *)file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
+}
+
+void releaseMappedRange(const MappedFile *file, const char *begin, const char *end) {
+    //the mapping starts on a page
+    size_t page = size_t(sysconf(_SC_PAGESIZE));
+    size_t first = (size_t(begin - file->data) + page - 1) / page * page;
+    size_t last = size_t(end - file->data) / page * page;
+    if (last > first) madvise((void *)(file->data + first), last - first, MADV_DONTNEED);
+}
+
+long long fileModificationTime(const char *filename) {
+    struct stat st;
+    if (stat(filename, &st) != 0) return 0;
+    return (long long)st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+}
+
+long long fileSize(const char *filename) {
+    struct stat st;
+    if (stat(filename, &st) != 0) return 0;
+    return (long long)st.st_size;
+}
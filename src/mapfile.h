@@ -0,0 +1,26 @@
+#ifndef __MAPFILE_H__
+#define __MAPFILE_H__
+
+#include <stddef.h>
+
+//! \file : read-only files mapped in memory, for loaders parsing or using their content in place
+
+typedef struct mapped_file_s {
+    const char *data; //! NULL for an empty file
+    size_t size;
+} MappedFile;
+
+//! map the whole of filename in memory, returns false (with a message) if it cannot be opened
+bool mapFile(const char *filename, MappedFile *file);
+void unmapFile(MappedFile *file);
+
+//! give back the memory of the pages fully inside [begin, end[ of file, they are read again if accessed
+void releaseMappedRange(const MappedFile *file, const char *begin, const char *end);
+
+//! modification time of filename in nanoseconds, 0 if it does not exist. a file rewritten within the
+//! second its copy was made is still seen as newer
+long long fileModificationTime(const char *filename);
+//! size of filename in bytes, 0 if it does not exist
+long long fileSize(const char *filename);
+
+#endif
@@ -0,0 +1,364 @@
+#include "mesh.h"
+#include <stdint.h>
+#include <queue>
+#include <algorithm>
+#include <unordered_map>
+
+//! a coarser level is generated while it keeps at least this many faces
+static const size_t mesh_lod_min_faces = 64;
+//! maximum number of levels, full resolution included
+static const size_t mesh_lod_max = 6;
+//! each level has about this ratio of the faces of the previous one
+static const float mesh_lod_ratio = 0.5f;
+//! screen area (in pixels) a face of the selected level should cover at least
+static const float mesh_lod_pixels_per_face = 4.f;
+//! weight of the planes keeping open borders in place
+static const double mesh_border_weight = 1000.0;
+//! a collapse may not leave a vertex with more faces around it than this. flat regions have about
+//! the same (null) cost everywhere, without it a single vertex would swallow them one edge at a time
+static const size_t mesh_collapse_max_faces = 16;
+
+size_t meshLodFaceCount(const MeshLod *lod) {
+    return lod->triangleCount + lod->quadCount;
+}
+
+size_t meshDataFaceCount(const MeshData *data) {
+    return data->triangles.size() / 3 + data->quads.size() / 4;
+}
+
+/* QUADRICS */
+//! symmetric 4x4 matrix of the squared distance to a set of planes, upper triangle stored by rows
+typedef struct quadric_s {
+    double m[10];
+} Quadric;
+
+static void quadricAddPlane(Quadric *q, dvec3 n, double d, double w) {
+    double p[4] = {n.x, n.y, n.z, d};
+    int k = 0;
+    for (int i = 0 ; i < 4 ; ++i)
+        for (int j = i ; j < 4 ; ++j)
+            q->m[k++] += w * p[i] * p[j];
+}
+
+static void quadricAdd(Quadric *q, const Quadric &o) {
+    for (int i = 0 ; i < 10 ; ++i)
+        q->m[i] += o.m[i];
+}
+
+static double quadricError(const Quadric &q, vec3 v) {
+    const double *m = q.m;
+    double x = v.x, y = v.y, z = v.z;
+    return m[0]*x*x + 2*m[1]*x*y + 2*m[2]*x*z + 2*m[3]*x
+         + m[4]*y*y + 2*m[5]*y*z + 2*m[6]*y
+         + m[7]*z*z + 2*m[8]*z
+         + m[9];
+}
+
+//! position minimizing the quadric, false if the system is (nearly) singular
+static bool quadricOptimum(const Quadric &q, vec3 *v) {
+    const double *m = q.m;
+    double a = m[0], b = m[1], c = m[2], d = m[4], e = m[5], f = m[7];
+    double det = a*(d*f - e*e) - b*(b*f - c*e) + c*(b*e - c*d);
+    if (fabs(det) < 1e-12) return false;
+    double r0 = -m[3], r1 = -m[6], r2 = -m[8];
+    double x = (r0*(d*f - e*e) - b*(r1*f - e*r2) + c*(r1*e - d*r2)) / det;
+    double y = (a*(r1*f - e*r2) - r0*(b*f - c*e) + c*(b*r2 - r1*c)) / det;
+    double z = (a*(d*r2 - r1*e) - b*(b*r2 - r1*c) + r0*(b*e - c*d)) / det;
+    *v = vec3(float(x), float(y), float(z));
+    return true;
+}
+
+/* EDGE COLLAPSE */
+typedef struct collapse_s {
+    double cost;
+    unsigned a, b; //! b is merged into a
+    unsigned versionA, versionB; //! versions of a and b when the cost was computed
+    vec3 position; //! position of the merged vertex
+    bool operator<(const struct collapse_s &o) const { return cost > o.cost; } //min-heap
+} Collapse;
+
+typedef struct simplifier_s {
+    std::vector<vec3> positions;
+    std::vector<unsigned> faces; //! 3 indices per triangle
+    std::vector<bool> faceAlive;
+    std::vector<bool> vertexAlive;
+    std::vector<unsigned> version;
+    std::vector<Quadric> quadrics;
+    std::vector<std::vector<unsigned> > vertexFaces;
+    std::priority_queue<Collapse> heap;
+} Simplifier;
+
+static dvec3 faceCross(const Simplifier &s, unsigned f) {
+    const unsigned *v = &s.faces[3*f];
+    dvec3 p0(s.positions[v[0]]), p1(s.positions[v[1]]), p2(s.positions[v[2]]);
+    return cross(p1 - p0, p2 - p0);
+}
+
+static void pushCollapse(Simplifier *s, unsigned a, unsigned b) {
+    Quadric q = s->quadrics[a];
+    quadricAdd(&q, s->quadrics[b]);
+
+    Collapse c;
+    c.a = a;
+    c.b = b;
+    c.versionA = s->version[a];
+    c.versionB = s->version[b];
+    if (!quadricOptimum(q, &c.position)) {
+        vec3 candidates[3] = {s->positions[a], s->positions[b], 0.5f * (s->positions[a] + s->positions[b])};
+        c.position = candidates[0];
+        for (vec3 p : candidates)
+            if (quadricError(q, p) < quadricError(q, c.position)) c.position = p;
+    }
+    c.cost = quadricError(q, c.position);
+    s->heap.push(c);
+}
+
+//! false if moving a and b to p flips or degenerates one of the faces kept around them
+static bool collapseKeepsOrientation(const Simplifier &s, unsigned a, unsigned b, vec3 p) {
+    unsigned ends[2] = {a, b};
+    for (unsigned e : ends) {
+        for (unsigned f : s.vertexFaces[e]) {
+            if (!s.faceAlive[f]) continue;
+            const unsigned *v = &s.faces[3*f];
+            bool hasA = v[0] == a || v[1] == a || v[2] == a;
+            bool hasB = v[0] == b || v[1] == b || v[2] == b;
+            if (hasA && hasB) continue; //removed by the collapse
+            vec3 q[3];
+            for (int k = 0 ; k < 3 ; ++k)
+                q[k] = v[k] == e ? p : s.positions[v[k]];
+            dvec3 before = faceCross(s, f);
+            dvec3 after = cross(dvec3(q[1]) - dvec3(q[0]), dvec3(q[2]) - dvec3(q[0]));
+            double la = length(after), lb = length(before);
+            if (la == 0.0 || dot(before, after) < 0.2 * la * lb) return false;
+        }
+    }
+    return true;
+}
+
+static size_t aliveFaceCount(const Simplifier &s, unsigned v) {
+    size_t count = 0;
+    for (unsigned f : s.vertexFaces[v]) count += s.faceAlive[f];
+    return count;
+}
+
+static void collapse(Simplifier *s, const Collapse &c, size_t *faceCount) {
+    unsigned a = c.a, b = c.b;
+    s->positions[a] = c.position;
+    quadricAdd(&s->quadrics[a], s->quadrics[b]);
+
+    for (unsigned f : s->vertexFaces[b]) {
+        if (!s->faceAlive[f]) continue;
+        unsigned *v = &s->faces[3*f];
+        if (v[0] == a || v[1] == a || v[2] == a) {
+            s->faceAlive[f] = false;
+            --*faceCount;
+        } else {
+            for (int k = 0 ; k < 3 ; ++k)
+                if (v[k] == b) v[k] = a;
+            s->vertexFaces[a].push_back(f);
+        }
+    }
+    s->vertexAlive[b] = false;
+    s->vertexFaces[b].clear();
+    ++s->version[a];
+
+    //drop dead faces from a and queue the new edges around it
+    std::vector<unsigned> &fa = s->vertexFaces[a];
+    size_t kept = 0;
+    for (unsigned f : fa)
+        if (s->faceAlive[f]) fa[kept++] = f;
+    fa.resize(kept);
+    std::vector<unsigned> neighbours;
+    for (unsigned f : fa)
+        for (int k = 0 ; k < 3 ; ++k)
+            if (s->faces[3*f+k] != a) neighbours.push_back(s->faces[3*f+k]);
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+    for (unsigned n : neighbours) pushCollapse(s, a, n);
+}
+
+static uint64_t edgeKey(unsigned a, unsigned b) {
+    return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+}
+
+void simplifyMeshData(const MeshData *in, size_t targetFaces, MeshData *out) {
+    Simplifier s;
+    s.positions = in->positions;
+    s.faces = in->triangles;
+    for (size_t i = 0 ; i < in->quads.size() ; i += 4) {
+        const unsigned *q = &in->quads[i];
+        unsigned split[6] = {q[0], q[1], q[2], q[0], q[2], q[3]};
+        s.faces.insert(s.faces.end(), split, split + 6);
+    }
+    size_t vertexCount = s.positions.size();
+    size_t faceCount = s.faces.size() / 3;
+    s.faceAlive.assign(faceCount, true);
+    s.vertexAlive.assign(vertexCount, true);
+    s.version.assign(vertexCount, 0);
+    s.quadrics.assign(vertexCount, Quadric());
+    s.vertexFaces.resize(vertexCount);
+
+    //plane quadrics, area weighted, and count of faces around each edge to find borders
+    std::unordered_map<uint64_t, int> edgeFaces;
+    for (unsigned f = 0 ; f < faceCount ; ++f) {
+        const unsigned *v = &s.faces[3*f];
+        dvec3 n = faceCross(s, f);
+        double area = length(n);
+        if (area > 0.0) {
+            n = n / area;
+            double d = -dot(n, dvec3(s.positions[v[0]]));
+            for (int k = 0 ; k < 3 ; ++k)
+                quadricAddPlane(&s.quadrics[v[k]], n, d, area * 0.5);
+        }
+        for (int k = 0 ; k < 3 ; ++k) {
+            s.vertexFaces[v[k]].push_back(f);
+            ++edgeFaces[edgeKey(v[k], v[(k+1)%3])];
+        }
+    }
+
+    //borders : planes orthogonal to the face through the edge keep them from shrinking
+    for (unsigned f = 0 ; f < faceCount ; ++f) {
+        const unsigned *v = &s.faces[3*f];
+        dvec3 n = faceCross(s, f);
+        if (length(n) == 0.0) continue;
+        for (int k = 0 ; k < 3 ; ++k) {
+            unsigned a = v[k], b = v[(k+1)%3];
+            if (edgeFaces[edgeKey(a, b)] != 1) continue;
+            dvec3 e = dvec3(s.positions[b]) - dvec3(s.positions[a]);
+            dvec3 bn = cross(e, n);
+            double len = length(bn);
+            if (len == 0.0) continue;
+            bn = bn / len;
+            double d = -dot(bn, dvec3(s.positions[a]));
+            quadricAddPlane(&s.quadrics[a], bn, d, mesh_border_weight);
+            quadricAddPlane(&s.quadrics[b], bn, d, mesh_border_weight);
+        }
+    }
+
+    for (auto &edge : edgeFaces)
+        pushCollapse(&s, unsigned(edge.first >> 32), unsigned(edge.first & 0xffffffffu));
+
+    while (faceCount > targetFaces && !s.heap.empty()) {
+        Collapse c = s.heap.top();
+        s.heap.pop();
+        if (!s.vertexAlive[c.a] || !s.vertexAlive[c.b]) continue;
+        if (s.version[c.a] != c.versionA || s.version[c.b] != c.versionB) continue;
+        //the two faces along the edge disappear
+        if (aliveFaceCount(s, c.a) + aliveFaceCount(s, c.b) > mesh_collapse_max_faces + 2) continue;
+        if (!collapseKeepsOrientation(s, c.a, c.b, c.position)) continue;
+        collapse(&s, c, &faceCount);
+    }
+
+    //compact the remaining vertices and faces
+    std::vector<unsigned> remap(vertexCount, ~0u);
+    out->positions.clear();
+    out->triangles.clear();
+    out->quads.clear();
+    for (size_t f = 0 ; f < s.faceAlive.size() ; ++f) {
+        if (!s.faceAlive[f]) continue;
+        for (int k = 0 ; k < 3 ; ++k) {
+            unsigned v = s.faces[3*f+k];
+            if (remap[v] == ~0u) {
+                remap[v] = unsigned(out->positions.size());
+                out->positions.push_back(s.positions[v]);
+            }
+            out->triangles.push_back(remap[v]);
+        }
+    }
+}
+
+static void quantizeMeshData(const Mesh *mesh, const MeshData *data, MeshLodStorage *lod) {
+    lod->positions.resize(3 * data->positions.size());
+    uint16_t *q = lod->positions.data();
+    for (const vec3 &p : data->positions) {
+        quantizeMeshVertex(mesh, p, q);
+        q += 3;
+    }
+    lod->triangles = data->triangles;
+    lod->quads = data->quads;
+}
+
+Mesh *initMesh() {
+    Mesh *mesh = new Mesh;
+    mesh->bmin = mesh->bmax = vec3(0.f);
+    mesh->quantScale = vec3(1.f);
+    mesh->cache.data = NULL;
+    mesh->cache.size = 0;
+    return mesh;
+}
+
+void resetMesh(Mesh *mesh, vec3 bmin, vec3 bmax) {
+    unmapFile(&mesh->cache);
+    mesh->storage.clear();
+    mesh->lods.clear();
+    mesh->bmin = bmin;
+    mesh->bmax = bmax;
+    //flat meshes still need a non zero step on their flat axis
+    mesh->quantScale = max(bmax - bmin, vec3(1e-6f)) * (1.f / mesh_quant_max);
+}
+
+void bindMeshStorage(Mesh *mesh) {
+    mesh->lods.resize(mesh->storage.size());
+    for (size_t i = 0 ; i < mesh->storage.size() ; ++i) {
+        const MeshLodStorage &st = mesh->storage[i];
+        MeshLod &lod = mesh->lods[i];
+        lod.positions = st.positions.data();
+        lod.triangles = st.triangles.data();
+        lod.quads = st.quads.data();
+        lod.vertexCount = st.positions.size() / 3;
+        lod.triangleCount = st.triangles.size() / 3;
+        lod.quadCount = st.quads.size() / 4;
+    }
+}
+
+void buildMeshLods(Mesh *mesh, const MeshData *base) {
+    vec3 bmin(0.f), bmax(0.f);
+    if (!base->positions.empty()) {
+        bmin = bmax = base->positions[0];
+        for (const vec3 &p : base->positions) {
+            bmin = min(bmin, p);
+            bmax = max(bmax, p);
+        }
+    }
+    resetMesh(mesh, bmin, bmax);
+
+    mesh->storage.resize(1);
+    quantizeMeshData(mesh, base, &mesh->storage[0]);
+
+    MeshData previous;
+    const MeshData *level = base;
+    while (mesh->storage.size() < mesh_lod_max) {
+        size_t faces = meshDataFaceCount(level);
+        size_t target = size_t(float(faces) * mesh_lod_ratio);
+        if (target < mesh_lod_min_faces) break;
+        MeshData coarser;
+        simplifyMeshData(level, target, &coarser);
+        //stop when the simplification gets stuck (every collapse left would fold the surface)
+        if (meshDataFaceCount(&coarser) > faces * 9 / 10) break;
+        mesh->storage.push_back(MeshLodStorage());
+        quantizeMeshData(mesh, &coarser, &mesh->storage.back());
+        previous.positions.swap(coarser.positions);
+        previous.triangles.swap(coarser.triangles);
+        previous.quads.swap(coarser.quads);
+        level = &previous;
+    }
+
+    //the storage does not move anymore, the levels can point in it
+    bindMeshStorage(mesh);
+}
+
+int selectMeshLod(const Mesh *mesh, float projectedRadius) {
+    float area = glm::pi<float>() * projectedRadius * projectedRadius;
+    size_t wanted = size_t(area / mesh_lod_pixels_per_face);
+    int lod = 0;
+    for (size_t i = 1 ; i < mesh->lods.size() ; ++i) {
+        if (meshLodFaceCount(&mesh->lods[i]) < wanted) break;
+        lod = int(i);
+    }
+    return lod;
+}
+
+void freeMesh(Mesh *mesh) {
+    unmapFile(&mesh->cache);
+    delete mesh;
+}
@@ -0,0 +1,86 @@
+#ifndef __MESH_H__
+#define __MESH_H__
+
+#include "defines.h"
+#include "mapfile.h"
+#include <stdint.h>
+#include <vector>
+
+//! \file : indexed meshes, loaded once and instanced by MESH objects (see initComplex)
+
+//! full precision indexed geometry in model space, as produced by loaders and simplification
+typedef struct mesh_data_s {
+    std::vector<vec3> positions;
+    std::vector<unsigned> triangles; //! 3 vertex indices per triangle
+    std::vector<unsigned> quads; //! 4 vertex indices per quad, in order around the quad
+} MeshData;
+
+//! one level of detail of a mesh as stored for rendering : positions are quantized on
+//! 16 bits per axis in the mesh bounds, see meshVertex. the buffers belong to the mesh
+typedef struct mesh_lod_s {
+    const uint16_t *positions; //! 3 per vertex
+    const unsigned *triangles; //! 3 vertex indices per triangle
+    const unsigned *quads; //! 4 vertex indices per quad, in order around the quad
+    size_t vertexCount, triangleCount, quadCount;
+} MeshLod;
+
+//! buffers of a level built in memory
+typedef struct mesh_lod_storage_s {
+    std::vector<uint16_t> positions;
+    std::vector<unsigned> triangles;
+    std::vector<unsigned> quads;
+} MeshLodStorage;
+
+typedef struct mesh_s {
+    std::vector<MeshLod> lods; //! lods[0] is the full resolution mesh, the next ones are coarser and coarser
+    vec3 bmin, bmax; //! model space bounds of the full resolution mesh
+    vec3 quantScale; //! model space size of one quantization step along each axis
+    std::vector<MeshLodStorage> storage; //! what the lods point to when built in memory
+    MappedFile cache; //! what the lods point to when loaded from a cache file (see loadMeshCache)
+} Mesh;
+
+//! largest quantized coordinate
+static const float mesh_quant_max = 65535.f;
+
+//! model space position of the vertex i of lod
+inline vec3 meshVertex(const Mesh *mesh, const MeshLod *lod, unsigned i) {
+    const uint16_t *q = lod->positions + 3*i;
+    return mesh->bmin + vec3(q[0], q[1], q[2]) * mesh->quantScale;
+}
+
+//! quantized coordinates of the model space position p, see meshVertex
+inline void quantizeMeshVertex(const Mesh *mesh, vec3 p, uint16_t *q) {
+    //simplified vertices may slightly leave the bounds of the full resolution mesh
+    vec3 c = clamp((p - mesh->bmin) * (1.f / mesh->quantScale) + 0.5f, 0.f, mesh_quant_max);
+    q[0] = uint16_t(c.x);
+    q[1] = uint16_t(c.y);
+    q[2] = uint16_t(c.z);
+}
+
+//! number of primitives (triangles + quads) of a level
+size_t meshLodFaceCount(const MeshLod *lod);
+size_t meshDataFaceCount(const MeshData *data);
+
+//! empty mesh, to be filled by buildMeshLods or loadMeshCache
+Mesh *initMesh();
+
+//! drop the levels of mesh and set its bounds, which fix the quantization of the levels to come
+void resetMesh(Mesh *mesh, vec3 bmin, vec3 bmax);
+
+//! point the levels of mesh in its storage, once every level is there
+void bindMeshStorage(Mesh *mesh);
+
+//! set the bounds of mesh from base, quantize it as lods[0] and generate the coarser levels
+//! by quadric edge collapse
+void buildMeshLods(Mesh *mesh, const MeshData *base);
+
+//! simplify in down to about targetFaces triangles (quadric edge collapse, Garland & Heckbert 97)
+void simplifyMeshData(const MeshData *in, size_t targetFaces, MeshData *out);
+
+//! coarsest level keeping about one primitive per few pixels, for an instance whose bounding
+//! sphere covers a disk of radius projectedRadius pixels on screen
+int selectMeshLod(const Mesh *mesh, float projectedRadius);
+
+void freeMesh(Mesh *mesh);
+
+#endif
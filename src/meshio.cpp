@@ -0,0 +1,813 @@
+#include "meshio.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <omp.h>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <sys/mman.h>
+
+/* NUMBERS */
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *skipBlanks(const char *s, const char *end) {
+    while (s < end && isBlank(*s)) ++s;
+    return s;
+}
+
+//! exact powers of ten representable by a double
+static const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+const char *parseFloat(const char *s, const char *end, float *value) {
+    const char *p = s;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    //digits beyond what the mantissa holds only move the exponent
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool digits = false;
+    for ( ; p < end && isDigit(*p) ; ++p, digits = true) {
+        if (mantissa < 100000000000000000ull) mantissa = mantissa * 10 + uint64_t(*p - '0');
+        else ++exponent;
+    }
+    if (p < end && *p == '.') {
+        for (++p ; p < end && isDigit(*p) ; ++p, digits = true) {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa * 10 + uint64_t(*p - '0');
+                --exponent;
+            }
+        }
+    }
+    if (!digits) return s;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool negativeExp = false;
+        if (q < end && (*q == '-' || *q == '+')) negativeExp = *q++ == '-';
+        if (q < end && isDigit(*q)) {
+            int e = 0;
+            for ( ; q < end && isDigit(*q) ; ++q)
+                if (e < 10000) e = e * 10 + (*q - '0');
+            exponent += negativeExp ? -e : e;
+            p = q;
+        }
+    }
+
+    double v = double(mantissa);
+    if (exponent < 0 && exponent >= -22) v /= pow10_table[-exponent];
+    else if (exponent > 0 && exponent <= 22) v *= pow10_table[exponent];
+    else if (exponent != 0) v *= pow(10.0, exponent);
+    *value = float(negative ? -v : v);
+    return p;
+}
+
+const char *parseInt(const char *s, const char *end, long *value) {
+    const char *p = s;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if (p >= end || !isDigit(*p)) return s;
+    long v = 0;
+    for ( ; p < end && isDigit(*p) ; ++p) v = v * 10 + (*p - '0');
+    *value = negative ? -v : v;
+    return p;
+}
+
+/* OBJ */
+//! files are cut in chunks of at least this many bytes, parsed in parallel
+static const size_t obj_min_chunk = 1 << 20;
+//! chunks per thread, so that uneven chunks still keep every thread busy
+static const size_t obj_chunks_per_thread = 4;
+//! largest chunk when streaming : the pages of the chunks being parsed are the only part of the file in memory
+static const size_t obj_stream_chunk = 8 << 20;
+//! a relative index is stored as its chunk-local vertex index minus this bias, making it negative
+//! while absolute (already 0-based) indices stay positive. the chunk vertex offset is added at merge
+static const long obj_relative_bias = 1L << 40;
+
+//! walk the v and f records of the lines in [p, end[ : sink->vertex(position) for each vertex, then
+//! sink->triangle(corners) or sink->quad(corners) with the raw OBJ indices (1-based, or negative for
+//! relative ones), larger polygons being split in a fan of triangles.
+//! returns the first malformed line (1-based), 0 if none, and counts the lines walked
+template <class Sink>
+static size_t walkObj(const char *p, const char *end, Sink *sink, size_t *lines) {
+    std::vector<long> polygon;
+    *lines = 0;
+    while (p < end) {
+        const char *eol = (const char *)memchr(p, '\n', size_t(end - p));
+        if (eol == NULL) eol = end;
+        ++*lines;
+        p = skipBlanks(p, eol);
+
+        if (eol - p > 1 && p[0] == 'v' && isBlank(p[1])) {
+            //vertex : x y z, an optional w is ignored
+            float c[3];
+            p += 2;
+            for (int i = 0 ; i < 3 ; ++i) {
+                const char *q = parseFloat(p = skipBlanks(p, eol), eol, &c[i]);
+                if (q == p) return *lines;
+                p = q;
+            }
+            sink->vertex(vec3(c[0], c[1], c[2]));
+        } else if (eol - p > 1 && p[0] == 'f' && isBlank(p[1])) {
+            //face : one v, v/vt, v//vn or v/vt/vn group per corner, only v is kept
+            polygon.clear();
+            p = skipBlanks(p + 2, eol);
+            while (p < eol) {
+                long index;
+                const char *q = parseInt(p, eol, &index);
+                if (q == p || index == 0) return *lines;
+                polygon.push_back(index);
+                for (p = q ; p < eol && !isBlank(*p) ; ++p) {}
+                p = skipBlanks(p, eol);
+            }
+            size_t n = polygon.size();
+            if (n == 4) {
+                sink->quad(polygon.data());
+            } else {
+                for (size_t i = 1 ; i + 1 < n ; ++i) {
+                    long tri[3] = {polygon[0], polygon[i], polygon[i+1]};
+                    sink->triangle(tri);
+                }
+            }
+        }
+        //vt, vn, groups, materials... are skipped
+        p = eol + 1;
+    }
+    return 0;
+}
+
+//! line aligned chunks of the file for the parallel passes, of about maxChunk bytes at most (0 for no limit) :
+//! chunk i is [bounds[i], bounds[i+1][
+static std::vector<const char *> objChunks(const MappedFile &file, size_t maxChunk) {
+    const char *begin = file.data, *end = file.data + file.size;
+    size_t chunkCount = std::max<size_t>(1, std::min(file.size / obj_min_chunk,
+                                                     size_t(omp_get_max_threads()) * obj_chunks_per_thread));
+    if (maxChunk > 0) chunkCount = std::max(chunkCount, (file.size + maxChunk - 1) / maxChunk);
+    std::vector<const char *> bounds(chunkCount + 1, end);
+    bounds[0] = begin;
+    for (size_t i = 1 ; i < chunkCount ; ++i) {
+        const char *p = std::max(bounds[i-1], begin + file.size / chunkCount * i);
+        const char *eol = (const char *)memchr(p, '\n', size_t(end - p));
+        bounds[i] = eol ? eol + 1 : end;
+    }
+    return bounds;
+}
+
+//! reports the first malformed line of the chunks, numbering lines across the whole file
+static bool reportObjErrors(const char *filename, const std::vector<size_t> &errorLines, const std::vector<size_t> &lines) {
+    size_t lineOffset = 0;
+    for (size_t i = 0 ; i < lines.size() ; ++i) {
+        if (errorLines[i]) {
+            fprintf(stderr, "%s:%zu : malformed line\n", filename, lineOffset + errorLines[i]);
+            return false;
+        }
+        lineOffset += lines[i];
+    }
+    return true;
+}
+
+//! what one chunk of the file produces, indices not resolved yet (see obj_relative_bias)
+typedef struct obj_chunk_s {
+    std::vector<vec3> positions;
+    std::vector<long> triangles;
+    std::vector<long> quads;
+
+    long corner(long index) const {
+        return index > 0 ? index - 1 : long(positions.size()) + index - obj_relative_bias;
+    }
+    void vertex(vec3 p) { positions.push_back(p); }
+    void triangle(const long *v) { for (int k = 0 ; k < 3 ; ++k) triangles.push_back(corner(v[k])); }
+    void quad(const long *v) { for (int k = 0 ; k < 4 ; ++k) quads.push_back(corner(v[k])); }
+} ObjChunk;
+
+//! copy the corners of a chunk in out, resolving relative indices with the chunk vertex offset.
+//! returns false if an index falls outside [0, vertexCount[
+static bool resolveObjCorners(const std::vector<long> &in, long vertexOffset, long vertexCount, unsigned *out) {
+    bool ok = true;
+    for (size_t i = 0 ; i < in.size() ; ++i) {
+        long index = in[i] < 0 ? in[i] + obj_relative_bias + vertexOffset : in[i];
+        ok &= index >= 0 && index < vertexCount;
+        out[i] = unsigned(index);
+    }
+    return ok;
+}
+
+bool loadObj(const char *filename, MeshData *out) {
+    MappedFile file;
+    if (!mapFile(filename, &file)) return false;
+    if (file.data) madvise((void *)file.data, file.size, MADV_SEQUENTIAL);
+
+    std::vector<const char *> bounds = objChunks(file, 0);
+    size_t chunkCount = bounds.size() - 1;
+    std::vector<ObjChunk> chunks(chunkCount);
+    std::vector<size_t> errorLines(chunkCount), lines(chunkCount);
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0 ; i < chunkCount ; ++i)
+        errorLines[i] = walkObj(bounds[i], bounds[i+1], &chunks[i], &lines[i]);
+    unmapFile(&file);
+    if (!reportObjErrors(filename, errorLines, lines)) return false;
+
+    //prefix sums give where each chunk goes in the merged arrays
+    std::vector<size_t> vertexOffset(chunkCount + 1, 0), triangleOffset(chunkCount + 1, 0), quadOffset(chunkCount + 1, 0);
+    for (size_t i = 0 ; i < chunkCount ; ++i) {
+        const ObjChunk &c = chunks[i];
+        vertexOffset[i+1] = vertexOffset[i] + c.positions.size();
+        triangleOffset[i+1] = triangleOffset[i] + c.triangles.size();
+        quadOffset[i+1] = quadOffset[i] + c.quads.size();
+    }
+
+    size_t firstVertex = out->positions.size(), firstTriangle = out->triangles.size(), firstQuad = out->quads.size();
+    out->positions.resize(firstVertex + vertexOffset[chunkCount]);
+    out->triangles.resize(firstTriangle + triangleOffset[chunkCount]);
+    out->quads.resize(firstQuad + quadOffset[chunkCount]);
+    long vertexCount = long(vertexOffset[chunkCount]);
+    bool ok = true;
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (size_t i = 0 ; i < chunkCount ; ++i) {
+        const ObjChunk &c = chunks[i];
+        std::copy(c.positions.begin(), c.positions.end(), out->positions.begin() + long(firstVertex + vertexOffset[i]));
+        ok = resolveObjCorners(c.triangles, long(vertexOffset[i]), vertexCount, out->triangles.data() + firstTriangle + triangleOffset[i]) && ok;
+        ok = resolveObjCorners(c.quads, long(vertexOffset[i]), vertexCount, out->quads.data() + firstQuad + quadOffset[i]) && ok;
+    }
+    if (!ok) {
+        fprintf(stderr, "%s : face index out of the %ld vertices\n", filename, vertexCount);
+        return false;
+    }
+    //indices are relative to the vertices of this file
+    if (firstVertex > 0) {
+        for (size_t i = firstTriangle ; i < out->triangles.size() ; ++i) out->triangles[i] += unsigned(firstVertex);
+        for (size_t i = firstQuad ; i < out->quads.size() ; ++i) out->quads[i] += unsigned(firstVertex);
+    }
+    return true;
+}
+
+/* STREAMED OBJ */
+//! first pass : sizes and bounds of a chunk
+typedef struct obj_count_s {
+    size_t vertices, triangles, quads;
+    vec3 bmin, bmax;
+
+    void vertex(vec3 p) {
+        bmin = vertices ? min(bmin, p) : p;
+        bmax = vertices ? max(bmax, p) : p;
+        ++vertices;
+    }
+    void triangle(const long *) { ++triangles; }
+    void quad(const long *) { ++quads; }
+} ObjCount;
+
+//! second pass : a chunk written right in its place of the level buffers, relative indices being
+//! resolved with the number of vertices before the chunk
+typedef struct obj_writer_s {
+    const Mesh *mesh;
+    uint16_t *positions;
+    unsigned *triangles, *quads;
+    long vertexCount; //! vertices of the file before the current record
+    bool ok;
+
+    unsigned corner(long index) {
+        long v = index > 0 ? index - 1 : vertexCount + index;
+        ok &= v >= 0 && v < long(mesh->lods[0].vertexCount);
+        return unsigned(v);
+    }
+    void vertex(vec3 p) {
+        quantizeMeshVertex(mesh, p, positions);
+        positions += 3;
+        ++vertexCount;
+    }
+    void triangle(const long *v) { for (int k = 0 ; k < 3 ; ++k) *triangles++ = corner(v[k]); }
+    void quad(const long *v) { for (int k = 0 ; k < 4 ; ++k) *quads++ = corner(v[k]); }
+} ObjWriter;
+
+bool streamObj(const char *filename, Mesh *mesh) {
+    MappedFile file;
+    if (!mapFile(filename, &file)) return false;
+    std::vector<const char *> bounds = objChunks(file, obj_stream_chunk);
+    size_t chunkCount = bounds.size() - 1;
+
+    std::vector<ObjCount> counts(chunkCount);
+    std::vector<size_t> errorLines(chunkCount), lines(chunkCount);
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0 ; i < chunkCount ; ++i) {
+        ObjCount &c = counts[i];
+        c.vertices = c.triangles = c.quads = 0;
+        errorLines[i] = walkObj(bounds[i], bounds[i+1], &c, &lines[i]);
+        releaseMappedRange(&file, bounds[i], bounds[i+1]);
+    }
+    if (!reportObjErrors(filename, errorLines, lines)) {
+        unmapFile(&file);
+        return false;
+    }
+
+    //prefix sums place every chunk in the level buffers, which are allocated once at their final size
+    std::vector<size_t> vertexOffset(chunkCount + 1, 0), triangleOffset(chunkCount + 1, 0), quadOffset(chunkCount + 1, 0);
+    vec3 bmin(0.f), bmax(0.f);
+    for (size_t i = 0 ; i < chunkCount ; ++i) {
+        const ObjCount &c = counts[i];
+        if (c.vertices) {
+            bmin = vertexOffset[i] ? min(bmin, c.bmin) : c.bmin;
+            bmax = vertexOffset[i] ? max(bmax, c.bmax) : c.bmax;
+        }
+        vertexOffset[i+1] = vertexOffset[i] + c.vertices;
+        triangleOffset[i+1] = triangleOffset[i] + c.triangles;
+        quadOffset[i+1] = quadOffset[i] + c.quads;
+    }
+    resetMesh(mesh, bmin, bmax);
+    mesh->storage.resize(1);
+    mesh->storage[0].positions.resize(3 * vertexOffset[chunkCount]);
+    mesh->storage[0].triangles.resize(3 * triangleOffset[chunkCount]);
+    mesh->storage[0].quads.resize(4 * quadOffset[chunkCount]);
+    bindMeshStorage(mesh);
+
+    bool ok = true;
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (size_t i = 0 ; i < chunkCount ; ++i) {
+        MeshLodStorage &st = mesh->storage[0];
+        ObjWriter w;
+        w.mesh = mesh;
+        w.positions = st.positions.data() + 3 * vertexOffset[i];
+        w.triangles = st.triangles.data() + 3 * triangleOffset[i];
+        w.quads = st.quads.data() + 4 * quadOffset[i];
+        w.vertexCount = long(vertexOffset[i]);
+        w.ok = true;
+        size_t chunkLines;
+        walkObj(bounds[i], bounds[i+1], &w, &chunkLines);
+        releaseMappedRange(&file, bounds[i], bounds[i+1]);
+        ok = w.ok && ok;
+    }
+    unmapFile(&file);
+    if (!ok) {
+        fprintf(stderr, "%s : face index out of the %zu vertices\n", filename, vertexOffset[chunkCount]);
+        return false;
+    }
+    return true;
+}
+
+/* PLY */
+enum PlyType {PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64};
+static const size_t ply_type_size[] = {1, 1, 2, 2, 4, 4, 4, 8};
+
+typedef struct ply_property_s {
+    std::string name;
+    PlyType type; //! of the value, or of the items of a list
+    bool list;
+    PlyType countType; //! of the item count of a list
+} PlyProperty;
+
+typedef struct ply_element_s {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+} PlyElement;
+
+static bool plyType(const std::string &name, PlyType *type) {
+    static const char *names[][2] = {{"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"}, {"ushort", "uint16"},
+                                     {"int", "int32"}, {"uint", "uint32"}, {"float", "float32"}, {"double", "float64"}};
+    for (int i = 0 ; i < 8 ; ++i) {
+        if (name == names[i][0] || name == names[i][1]) {
+            *type = PlyType(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool hostIsBigEndian() {
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 0;
+}
+
+//! value of type at p, whose bytes are reversed first if swap
+static inline double plyValue(const char *p, PlyType type, bool swap) {
+    uint8_t b[8];
+    size_t size = ply_type_size[type];
+    memcpy(b, p, size);
+    if (swap) std::reverse(b, b + size);
+    switch (type) {
+        case PLY_INT8: { int8_t v; memcpy(&v, b, 1); return v; }
+        case PLY_UINT8: return b[0];
+        case PLY_INT16: { int16_t v; memcpy(&v, b, 2); return v; }
+        case PLY_UINT16: { uint16_t v; memcpy(&v, b, 2); return v; }
+        case PLY_INT32: { int32_t v; memcpy(&v, b, 4); return v; }
+        case PLY_UINT32: { uint32_t v; memcpy(&v, b, 4); return v; }
+        case PLY_FLOAT32: { float v; memcpy(&v, b, 4); return v; }
+        case PLY_FLOAT64: { double v; memcpy(&v, b, 8); return v; }
+    }
+    return 0.0;
+}
+
+//! reads the header up to end_header, *body is then the start of the binary data
+static bool parsePlyHeader(const MappedFile &file, std::vector<PlyElement> *elements, bool *bigEndian, const char **body, std::string *error) {
+    const char *p = file.data, *end = file.data + file.size;
+    bool first = true, format = false;
+    while (p < end) {
+        const char *eol = (const char *)memchr(p, '\n', size_t(end - p));
+        if (eol == NULL) break;
+        std::istringstream line(std::string(p, eol));
+        p = eol + 1;
+        std::string keyword;
+        line >> keyword;
+        if (first) {
+            if (keyword != "ply") { *error = "not a PLY file"; return false; }
+            first = false;
+        } else if (keyword == "format") {
+            std::string name;
+            line >> name;
+            if (name == "binary_little_endian") *bigEndian = false;
+            else if (name == "binary_big_endian") *bigEndian = true;
+            else { *error = "only binary PLY files are supported, not " + name; return false; }
+            format = true;
+        } else if (keyword == "element") {
+            PlyElement e;
+            if (!(line >> e.name >> e.count)) { *error = "bad element"; return false; }
+            elements->push_back(e);
+        } else if (keyword == "property") {
+            PlyProperty prop;
+            std::string type;
+            line >> type;
+            prop.list = type == "list";
+            bool ok = !elements->empty();
+            if (prop.list) {
+                std::string countType;
+                line >> countType >> type;
+                ok = ok && plyType(countType, &prop.countType) && prop.countType <= PLY_UINT32;
+            }
+            ok = ok && plyType(type, &prop.type) && bool(line >> prop.name);
+            if (!ok) { *error = "bad property"; return false; }
+            elements->back().properties.push_back(prop);
+        } else if (keyword == "end_header") {
+            *body = p;
+            if (!format) { *error = "no format"; return false; }
+            return true;
+        }
+        //comment, obj_info... are skipped
+    }
+    *error = "no end_header";
+    return false;
+}
+
+//! size of the record of an element without lists, 0 if it has some
+static size_t plyFixedStride(const PlyElement &e) {
+    size_t stride = 0;
+    for (const PlyProperty &prop : e.properties) {
+        if (prop.list) return 0;
+        stride += ply_type_size[prop.type];
+    }
+    return stride;
+}
+
+//! end of the value (or list) of prop at p, NULL if it goes past end. the items of a list are handed
+//! to items if not NULL
+static const char *readPlyProperty(const char *p, const char *end, const PlyProperty &prop, bool swap, std::vector<long> *items) {
+    if (!prop.list) {
+        size_t size = ply_type_size[prop.type];
+        return size_t(end - p) < size ? NULL : p + size;
+    }
+    size_t countSize = ply_type_size[prop.countType], itemSize = ply_type_size[prop.type];
+    if (size_t(end - p) < countSize) return NULL;
+    size_t n = size_t(plyValue(p, prop.countType, swap));
+    p += countSize;
+    if (n > size_t(end - p) / itemSize) return NULL;
+    if (items) {
+        items->resize(n);
+        for (size_t k = 0 ; k < n ; ++k) (*items)[k] = long(plyValue(p + k * itemSize, prop.type, swap));
+    }
+    return p + n * itemSize;
+}
+
+//! walk a record of e at p without going past end, returns its end or NULL if it is truncated.
+//! the items of the list property at index listIndex are handed to out
+static const char *walkPlyRecord(const char *p, const char *end, const PlyElement &e, bool swap,
+                                 int listIndex, std::vector<long> *out) {
+    for (size_t i = 0 ; p && i < e.properties.size() ; ++i)
+        p = readPlyProperty(p, end, e.properties[i], swap, int(i) == listIndex ? out : NULL);
+    return p;
+}
+
+static bool readPlyVertices(const char **p, const char *end, const PlyElement &e, bool swap, MeshData *out) {
+    //offsets of x, y and z in a record
+    int axis[3] = {-1, -1, -1};
+    size_t offsets[3] = {0, 0, 0}, offset = 0;
+    for (size_t i = 0 ; i < e.properties.size() ; ++i) {
+        const PlyProperty &prop = e.properties[i];
+        for (int k = 0 ; k < 3 ; ++k) {
+            if (prop.name == std::string(1, char('x' + k)) && !prop.list) {
+                axis[k] = int(i);
+                offsets[k] = offset;
+            }
+        }
+        offset += prop.list ? 0 : ply_type_size[prop.type];
+    }
+    if (axis[0] < 0 || axis[1] < 0 || axis[2] < 0) return false;
+
+    //the count comes from the header : bounded by the bytes left before anything is allocated,
+    //a record with lists takes at least a byte
+    size_t stride = plyFixedStride(e);
+    if (e.count > size_t(end - *p) / (stride > 0 ? stride : 1)) return false;
+    size_t first = out->positions.size();
+    out->positions.resize(first + e.count);
+    vec3 *dst = out->positions.data() + first;
+    bool floats = e.properties[axis[0]].type == PLY_FLOAT32 && e.properties[axis[1]].type == PLY_FLOAT32
+               && e.properties[axis[2]].type == PLY_FLOAT32;
+
+    if (stride > 0 && floats && !swap) {
+        //the common case : native floats in fixed size records, copied as they are
+        const char *src = *p;
+        if (stride == sizeof(vec3) && offsets[0] == 0 && offsets[1] == 4 && offsets[2] == 8) {
+            memcpy(dst, src, e.count * sizeof(vec3));
+        } else {
+            for (size_t i = 0 ; i < e.count ; ++i, src += stride) {
+                memcpy(&dst[i].x, src + offsets[0], 4);
+                memcpy(&dst[i].y, src + offsets[1], 4);
+                memcpy(&dst[i].z, src + offsets[2], 4);
+            }
+        }
+        *p += e.count * stride;
+        return true;
+    }
+    if (stride > 0) {
+        const char *src = *p;
+        for (size_t i = 0 ; i < e.count ; ++i, src += stride)
+            for (int k = 0 ; k < 3 ; ++k)
+                dst[i][k] = float(plyValue(src + offsets[k], e.properties[axis[k]].type, swap));
+        *p += e.count * stride;
+        return true;
+    }
+    //records with lists (unusual for vertices) : walked one property after the other
+    for (size_t i = 0 ; i < e.count ; ++i) {
+        const char *q = *p;
+        for (size_t j = 0 ; j < e.properties.size() ; ++j) {
+            const PlyProperty &prop = e.properties[j];
+            const char *next = readPlyProperty(q, end, prop, swap, NULL);
+            if (next == NULL) return false;
+            for (int k = 0 ; k < 3 ; ++k)
+                if (axis[k] == int(j)) dst[i][k] = float(plyValue(q, prop.type, swap));
+            q = next;
+        }
+        *p = q;
+    }
+    return true;
+}
+
+static bool readPlyFaces(const char **p, const char *end, const PlyElement &e, bool swap, size_t firstVertex, MeshData *out) {
+    int indices = -1;
+    for (size_t i = 0 ; i < e.properties.size() ; ++i)
+        if (e.properties[i].list && (e.properties[i].name == "vertex_indices" || e.properties[i].name == "vertex_index"))
+            indices = int(i);
+    if (indices < 0) return false;
+    const PlyProperty &prop = e.properties[indices];
+    long vertexCount = long(out->positions.size() - firstVertex);
+
+    //the common case : faces made of their index list only, with 8 bit counts and 32 bit indices
+    bool direct = e.properties.size() == 1 && prop.countType == PLY_UINT8
+               && (prop.type == PLY_INT32 || prop.type == PLY_UINT32) && !swap;
+    std::vector<long> polygon;
+    const char *q = *p;
+    for (size_t f = 0 ; f < e.count ; ++f) {
+        if (direct) {
+            if (q >= end) return false;
+            size_t n = uint8_t(*q++);
+            if (n * 4 > size_t(end - q)) return false;
+            polygon.resize(n);
+            for (size_t k = 0 ; k < n ; ++k) {
+                int32_t v;
+                memcpy(&v, q + 4 * k, 4);
+                polygon[k] = prop.type == PLY_UINT32 ? long(uint32_t(v)) : long(v);
+            }
+            q += 4 * n;
+        } else {
+            q = walkPlyRecord(q, end, e, swap, indices, &polygon);
+            if (q == NULL) return false;
+        }
+        for (long &v : polygon) {
+            if (v < 0 || v >= vertexCount) return false;
+            v += long(firstVertex);
+        }
+        size_t n = polygon.size();
+        if (n == 4) {
+            for (long v : polygon) out->quads.push_back(unsigned(v));
+        } else {
+            for (size_t i = 1 ; i + 1 < n ; ++i) {
+                unsigned tri[3] = {unsigned(polygon[0]), unsigned(polygon[i]), unsigned(polygon[i+1])};
+                out->triangles.insert(out->triangles.end(), tri, tri + 3);
+            }
+        }
+    }
+    *p = q;
+    return true;
+}
+
+bool loadPly(const char *filename, MeshData *out) {
+    MappedFile file;
+    if (!mapFile(filename, &file)) return false;
+    std::vector<PlyElement> elements;
+    bool bigEndian = false;
+    const char *p = NULL, *end = file.data + file.size;
+    std::string error;
+    bool ok = parsePlyHeader(file, &elements, &bigEndian, &p, &error);
+    bool swap = bigEndian != hostIsBigEndian();
+
+    size_t firstVertex = out->positions.size();
+    for (size_t i = 0 ; ok && i < elements.size() ; ++i) {
+        const PlyElement &e = elements[i];
+        if (e.name == "vertex") {
+            ok = readPlyVertices(&p, end, e, swap, out);
+            if (!ok) error = "bad or truncated vertices";
+        } else if (e.name == "face") {
+            ok = readPlyFaces(&p, end, e, swap, firstVertex, out);
+            if (!ok) error = "bad or truncated faces";
+        } else {
+            //other elements (edges, materials...) are skipped
+            size_t stride = plyFixedStride(e);
+            if (stride > 0) {
+                ok = e.count <= size_t(end - p) / stride;
+                p += ok ? e.count * stride : 0;
+            } else {
+                for (size_t r = 0 ; ok && r < e.count ; ++r) ok = (p = walkPlyRecord(p, end, e, swap, -1, NULL)) != NULL;
+            }
+            if (!ok) error = "truncated " + e.name;
+        }
+    }
+    unmapFile(&file);
+    if (!ok) fprintf(stderr, "%s : %s\n", filename, error.c_str());
+    return ok;
+}
+
+/* MESH CACHE */
+//! a cache is a header, one MeshCacheLod per level, then the buffers of the levels, each one starting on
+//! mesh_cache_align bytes. offsets count from the start of the file, everything is in native byte order
+static const char mesh_cache_magic[4] = {'M', 'R', 'T', 'M'};
+static const uint32_t mesh_cache_version = 1;
+//! written as is, reads differently on a machine of the other endianness
+static const uint32_t mesh_cache_byte_order = 0x01020304;
+static const size_t mesh_cache_align = 16;
+static const uint32_t mesh_cache_max_lods = 64;
+
+typedef struct mesh_cache_header_s {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t lodCount;
+    float bmin[3], bmax[3], quantScale[3];
+    uint32_t reserved; //! keeps the level table 8 bytes aligned
+} MeshCacheHeader;
+
+typedef struct mesh_cache_lod_s {
+    uint64_t vertexCount, triangleCount, quadCount;
+    uint64_t positions, triangles, quads; //! offsets of the buffers
+} MeshCacheLod;
+
+static inline uint64_t alignCacheOffset(uint64_t offset) {
+    return (offset + mesh_cache_align - 1) / mesh_cache_align * mesh_cache_align;
+}
+
+//! write size bytes of data at offset, padding with zeros from *written
+static bool writeCacheBlock(FILE *f, uint64_t *written, uint64_t offset, const void *data, size_t size) {
+    static const char zeros[mesh_cache_align] = {0};
+    if (offset - *written > 0 && fwrite(zeros, 1, size_t(offset - *written), f) != offset - *written) return false;
+    if (size > 0 && fwrite(data, 1, size, f) != size) return false;
+    *written = offset + size;
+    return true;
+}
+
+bool writeMeshCache(const char *filename, const Mesh *mesh) {
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, mesh_cache_magic, 4);
+    header.version = mesh_cache_version;
+    header.byteOrder = mesh_cache_byte_order;
+    header.lodCount = uint32_t(mesh->lods.size());
+    for (int i = 0 ; i < 3 ; ++i) {
+        header.bmin[i] = mesh->bmin[i];
+        header.bmax[i] = mesh->bmax[i];
+        header.quantScale[i] = mesh->quantScale[i];
+    }
+
+    std::vector<MeshCacheLod> table(mesh->lods.size());
+    uint64_t offset = sizeof(MeshCacheHeader) + table.size() * sizeof(MeshCacheLod);
+    for (size_t i = 0 ; i < table.size() ; ++i) {
+        const MeshLod &lod = mesh->lods[i];
+        MeshCacheLod &entry = table[i];
+        entry.vertexCount = lod.vertexCount;
+        entry.triangleCount = lod.triangleCount;
+        entry.quadCount = lod.quadCount;
+        entry.positions = offset = alignCacheOffset(offset);
+        offset += lod.vertexCount * 3 * sizeof(uint16_t);
+        entry.triangles = offset = alignCacheOffset(offset);
+        offset += lod.triangleCount * 3 * sizeof(unsigned);
+        entry.quads = offset = alignCacheOffset(offset);
+        offset += lod.quadCount * 4 * sizeof(unsigned);
+    }
+
+    //written aside then renamed, so that a concurrent run never maps a partial cache
+    std::string tmp = std::string(filename) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (f == NULL) return false;
+    uint64_t written = 0;
+    bool ok = writeCacheBlock(f, &written, 0, &header, sizeof(header))
+            && writeCacheBlock(f, &written, written, table.data(), table.size() * sizeof(MeshCacheLod));
+    for (size_t i = 0 ; ok && i < table.size() ; ++i) {
+        const MeshLod &lod = mesh->lods[i];
+        ok = writeCacheBlock(f, &written, table[i].positions, lod.positions, lod.vertexCount * 3 * sizeof(uint16_t))
+          && writeCacheBlock(f, &written, table[i].triangles, lod.triangles, lod.triangleCount * 3 * sizeof(unsigned))
+          && writeCacheBlock(f, &written, table[i].quads, lod.quads, lod.quadCount * 4 * sizeof(unsigned));
+    }
+    ok = fclose(f) == 0 && ok;
+    if (ok) ok = rename(tmp.c_str(), filename) == 0;
+    if (!ok) remove(tmp.c_str());
+    return ok;
+}
+
+//! true if count elements of components values of valueSize bytes at offset lie in a file of size bytes,
+//! aligned for their type. count is bounded before it is multiplied, so a bad header cannot overflow
+static bool validCacheBuffer(uint64_t offset, uint64_t count, size_t components, size_t valueSize, size_t size) {
+    return offset % valueSize == 0 && offset <= size && count <= (size - offset) / valueSize / components;
+}
+
+//! true if the count corners of faces all fall in [0, vertexCount[, as the OBJ and PLY loaders check
+static bool validCacheCorners(const unsigned *corners, size_t count, size_t vertexCount) {
+    bool ok = true;
+    for (size_t i = 0 ; i < count ; ++i) ok &= corners[i] < vertexCount;
+    return ok;
+}
+
+bool loadMeshCache(const char *filename, Mesh *mesh) {
+    MappedFile file;
+    if (!mapFile(filename, &file)) return false;
+
+    MeshCacheHeader header;
+    bool ok = file.size >= sizeof(header);
+    if (ok) {
+        memcpy(&header, file.data, sizeof(header));
+        ok = memcmp(header.magic, mesh_cache_magic, 4) == 0 && header.version == mesh_cache_version
+          && header.byteOrder == mesh_cache_byte_order && header.lodCount > 0 && header.lodCount <= mesh_cache_max_lods
+          && file.size >= sizeof(header) + header.lodCount * sizeof(MeshCacheLod);
+    }
+    std::vector<MeshLod> lods(ok ? header.lodCount : 0);
+    for (size_t i = 0 ; ok && i < lods.size() ; ++i) {
+        MeshCacheLod entry;
+        memcpy(&entry, file.data + sizeof(header) + i * sizeof(MeshCacheLod), sizeof(entry));
+        ok = validCacheBuffer(entry.positions, entry.vertexCount, 3, sizeof(uint16_t), file.size)
+          && validCacheBuffer(entry.triangles, entry.triangleCount, 3, sizeof(unsigned), file.size)
+          && validCacheBuffer(entry.quads, entry.quadCount, 4, sizeof(unsigned), file.size);
+        if (!ok) break;
+        MeshLod &lod = lods[i];
+        lod.positions = (const uint16_t *)(file.data + entry.positions);
+        lod.triangles = (const unsigned *)(file.data + entry.triangles);
+        lod.quads = (const unsigned *)(file.data + entry.quads);
+        lod.vertexCount = size_t(entry.vertexCount);
+        lod.triangleCount = size_t(entry.triangleCount);
+        lod.quadCount = size_t(entry.quadCount);
+        //a stale or corrupt cache must not send the intersection outside the positions
+        ok = validCacheCorners(lod.triangles, lod.triangleCount * 3, lod.vertexCount)
+          && validCacheCorners(lod.quads, lod.quadCount * 4, lod.vertexCount);
+    }
+    if (!ok) {
+        unmapFile(&file);
+        return false;
+    }
+
+    unmapFile(&mesh->cache);
+    mesh->storage.clear();
+    mesh->lods.swap(lods);
+    mesh->bmin = vec3(header.bmin[0], header.bmin[1], header.bmin[2]);
+    mesh->bmax = vec3(header.bmax[0], header.bmax[1], header.bmax[2]);
+    mesh->quantScale = vec3(header.quantScale[0], header.quantScale[1], header.quantScale[2]);
+    mesh->cache = file;
+    return true;
+}
+
+//! OBJ files from this size on are streamed : their full precision copy and the simplification
+//! of their levels of detail would take several times the memory of the final mesh
+static const long long mesh_stream_min_size = 64ll << 20;
+
+bool loadMesh(const char *filename, Mesh *mesh) {
+    std::string cache = std::string(filename) + MESH_CACHE_SUFFIX;
+    long long sourceTime = fileModificationTime(filename);
+    long long cacheTime = fileModificationTime(cache.c_str());
+    if (cacheTime > 0 && cacheTime >= sourceTime && loadMeshCache(cache.c_str(), mesh)) return true;
+
+    size_t length = strlen(filename);
+    bool isPly = length >= 4 && strcasecmp(filename + length - 4, ".ply") == 0;
+    if (!isPly && fileSize(filename) >= mesh_stream_min_size) {
+        if (!streamObj(filename, mesh)) return false;
+    } else {
+        MeshData base;
+        if (!(isPly ? loadPly(filename, &base) : loadObj(filename, &base))) return false;
+        buildMeshLods(mesh, &base);
+    }
+    if (!writeMeshCache(cache.c_str(), mesh))
+        fprintf(stderr, "Cannot write mesh cache %s, the mesh will be parsed again next time\n", cache.c_str());
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __MESHIO_H__
+#define __MESHIO_H__
+
+#include "mesh.h"
+
+//! \file : mesh file loaders, from files mapped in memory
+
+//! appended to the name of a mesh file to get the name of its cache
+#define MESH_CACHE_SUFFIX ".mrtmesh"
+
+//! parse a decimal number (sign, fraction and exponent allowed) at s, without going past end.
+//! returns the position after the number, or s if there is none
+const char *parseFloat(const char *s, const char *end, float *value);
+const char *parseInt(const char *s, const char *end, long *value);
+
+//! load the vertices (v) and faces (f) of an OBJ file : triangles and quads are kept as such,
+//! larger polygons are split in a fan of triangles, negative indices are relative to the last vertex.
+//! everything else (normals, texture coordinates, groups, materials) is ignored
+bool loadObj(const char *filename, MeshData *out);
+
+//! load an OBJ file straight into the full resolution level of mesh, with memory bounded by the size of
+//! that level : a first pass counts the records and their bounds, the second one quantizes them in place.
+//! no coarser level is built (simplification needs the whole full precision mesh)
+bool streamObj(const char *filename, Mesh *mesh);
+
+//! load the vertex positions and faces of a binary PLY file (either endianness) : triangles and quads are
+//! kept as such, larger polygons are split in a fan of triangles. other properties and elements are skipped
+bool loadPly(const char *filename, MeshData *out);
+
+//! binary cache of a built mesh (bounds and every level of detail, quantized), see meshio.cpp for the layout.
+//! returns false (without a message) if it cannot be written
+bool writeMeshCache(const char *filename, const Mesh *mesh);
+
+//! map a cache written by writeMeshCache, the levels of mesh then point in the mapping (no copy).
+//! its header, its buffer extents and the vertex indices of its faces are checked, false if one is wrong
+bool loadMeshCache(const char *filename, Mesh *mesh);
+
+//! build the mesh of filename (.ply for a binary PLY, OBJ otherwise), from its cache (filename + MESH_CACHE_SUFFIX)
+//! when that is newer than the file, otherwise from the file itself, writing the cache for the next runs.
+//! OBJ files of mesh_stream_min_size bytes or more are streamed (see streamObj), without levels of detail
+bool loadMesh(const char *filename, Mesh *mesh);
+
+#endif
@@ -0,0 +1,185 @@
+#include "pagecache.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+typedef std::shared_ptr<const std::vector<unsigned char> > PageTexels;
+
+typedef struct cached_page_s {
+    PageTexels texels;
+    std::list<uint64_t>::iterator use; //! place in PageCache::uses
+} CachedPage;
+
+//! pages last used by a thread, direct mapped by key. they hold their texels even once dropped from
+//! the shared cache, so a thread never waits for another one to be done with a page
+static const size_t local_pages_log = 4;
+
+typedef struct local_page_s {
+    uint64_t key; //! 0 for an empty entry, keys start at 1
+    PageTexels texels;
+} LocalPage;
+
+struct local_page_cache_s;
+
+typedef struct page_cache_s {
+    std::mutex lock;
+    size_t capacity, size;
+    std::list<uint64_t> uses; //! keys of the pages, the most recently used first
+    std::unordered_map<uint64_t, CachedPage> pages;
+    uint64_t lookups, misses, bytesRead; //! lookups counts only those the threads did not find aside
+    uint64_t retiredHits; //! found aside by threads that are gone
+    std::vector<struct local_page_cache_s*> threads;
+} PageCache;
+
+//! built on first use, like the asset cache
+static PageCache &pageCache() {
+    static PageCache cache;
+    return cache;
+}
+
+static std::atomic<uint64_t> next_page_key(1);
+
+typedef struct local_page_cache_s {
+    LocalPage pages[size_t(1) << local_pages_log];
+    std::atomic<uint64_t> hits; //! only written by its thread, read by textureCacheStats
+
+    local_page_cache_s() : hits(0) {
+        for (LocalPage &page : pages) page.key = 0;
+        PageCache &cache = pageCache();
+        std::lock_guard<std::mutex> guard(cache.lock);
+        cache.threads.push_back(this);
+    }
+    ~local_page_cache_s() {
+        PageCache &cache = pageCache();
+        std::lock_guard<std::mutex> guard(cache.lock);
+        cache.retiredHits += hits.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < cache.threads.size(); ++i)
+            if (cache.threads[i] == this) {
+                cache.threads[i] = cache.threads.back();
+                cache.threads.pop_back();
+                break;
+            }
+    }
+} LocalPageCache;
+
+static void dropPage(PageCache &cache, std::unordered_map<uint64_t, CachedPage>::iterator it) {
+    cache.size -= it->second.texels->size();
+    cache.uses.erase(it->second.use);
+    cache.pages.erase(it);
+}
+
+//! drop the least recently used pages down to the capacity, but the most recent one
+static void shrinkPageCache(PageCache &cache) {
+    while (cache.size > cache.capacity && cache.uses.size() > 1)
+        dropPage(cache, cache.pages.find(cache.uses.back()));
+}
+
+void setTextureCacheCapacity(size_t bytes) {
+    PageCache &cache = pageCache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    cache.capacity = bytes;
+    shrinkPageCache(cache);
+}
+
+size_t textureCacheCapacity() {
+    PageCache &cache = pageCache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    return cache.capacity;
+}
+
+uint64_t reserveTexturePages(size_t count) {
+    return next_page_key.fetch_add(count);
+}
+
+void dropTexturePages(uint64_t first, size_t count) {
+    PageCache &cache = pageCache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    for (uint64_t key = first; key < first + count && !cache.pages.empty(); ++key) {
+        auto it = cache.pages.find(key);
+        if (it != cache.pages.end()) dropPage(cache, it);
+    }
+}
+
+//! texels of page of level from its file, zeros (with a message) if it cannot be read
+static PageTexels readPage(const TextureLevel &level, size_t page, size_t bytes) {
+    std::vector<unsigned char> *texels = new std::vector<unsigned char>(bytes);
+    off_t offset = off_t(level.offset + page * bytes);
+    for (size_t done = 0; done < bytes;) {
+        ssize_t n = pread(level.file, texels->data() + done, bytes - done, offset + off_t(done));
+        if (n <= 0) {
+            fprintf(stderr, "Cannot read a texture page at %lld\n", (long long)offset);
+            memset(texels->data(), 0, bytes);
+            break;
+        }
+        done += size_t(n);
+    }
+    return PageTexels(texels);
+}
+
+//! the page from the shared cache, read without holding the lock on a miss : two threads may then read the
+//! same page, the first one stored is kept
+static PageTexels sharedPage(const TextureLevel &level, size_t page, uint64_t key) {
+    PageCache &cache = pageCache();
+    {
+        std::lock_guard<std::mutex> guard(cache.lock);
+        ++cache.lookups;
+        auto it = cache.pages.find(key);
+        if (it != cache.pages.end()) {
+            cache.uses.splice(cache.uses.begin(), cache.uses, it->second.use);
+            return it->second.texels;
+        }
+    }
+    size_t bytes = tileBytes(level.format) << (2 * texture_page_log);
+    PageTexels texels = readPage(level, page, bytes);
+
+    std::lock_guard<std::mutex> guard(cache.lock);
+    ++cache.misses;
+    cache.bytesRead += bytes;
+    auto it = cache.pages.find(key);
+    if (it != cache.pages.end()) return it->second.texels;
+    cache.uses.push_front(key);
+    CachedPage &cached = cache.pages[key];
+    cached.texels = texels;
+    cached.use = cache.uses.begin();
+    cache.size += bytes;
+    shrinkPageCache(cache);
+    return texels;
+}
+
+const unsigned char *texturePage(const TextureLevel &level, size_t page) {
+    static thread_local LocalPageCache local;
+    uint64_t key = level.firstPage + page;
+    LocalPage &entry = local.pages[(key * 0x9e3779b97f4a7c15ull) >> (64 - local_pages_log)];
+    if (entry.key == key) {
+        local.hits.store(local.hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return entry.texels->data();
+    }
+    entry.texels = sharedPage(level, page, key);
+    entry.key = key;
+    return entry.texels->data();
+}
+
+const unsigned char *pagedTile(const TextureLevel &level, size_t tile) {
+    const unsigned char *page = texturePage(level, tile >> (2 * texture_page_log));
+    return page + (tile & ((size_t(1) << (2 * texture_page_log)) - 1)) * tileBytes(level.format);
+}
+
+TextureCacheStats textureCacheStats() {
+    PageCache &cache = pageCache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    TextureCacheStats stats;
+    stats.capacity = cache.capacity;
+    stats.size = cache.size;
+    stats.lookups = cache.lookups + cache.retiredHits;
+    for (const LocalPageCache *local : cache.threads)
+        stats.lookups += local->hits.load(std::memory_order_relaxed);
+    stats.misses = cache.misses;
+    stats.bytesRead = cache.bytesRead;
+    return stats;
+}
@@ -0,0 +1,35 @@
+#ifndef __PAGECACHE_H__
+#define __PAGECACHE_H__
+
+#include "texture.h"
+#include <stddef.h>
+#include <stdint.h>
+
+//! \file : bounded cache of the pages of paged texture levels, read from their file on first use.
+//! every thread keeps its last pages aside, most samples find their page there without locking
+
+typedef struct texture_cache_stats_s {
+    size_t capacity; //! bytes
+    size_t size; //! bytes of the pages in the cache
+    uint64_t lookups; //! pages asked by the samples
+    uint64_t misses; //! pages that had to be read
+    uint64_t bytesRead;
+} TextureCacheStats;
+
+//! the cache keeps at most bytes of pages, the least recently used ones are dropped first.
+//! 0 (the default) : textures are read in memory in full, nothing is paged
+void setTextureCacheCapacity(size_t bytes);
+size_t textureCacheCapacity();
+
+//! keys of count pages, never handed out again
+uint64_t reserveTexturePages(size_t count);
+//! remove the pages of keys [first, first + count[ from the cache, when their level goes away
+void dropTexturePages(uint64_t first, size_t count);
+
+//! texels of page of level, read from its file if they are not in the cache.
+//! valid until the next call from the same thread
+const unsigned char *texturePage(const TextureLevel &level, size_t page);
+
+TextureCacheStats textureCacheStats();
+
+#endif
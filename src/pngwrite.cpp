@@ -0,0 +1,506 @@
+#include "pngwrite.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+/* checksums */
+
+static const uint32_t adler_base = 65521;
+
+static uint32_t adler32(const unsigned char *bytes, size_t size) {
+    uint32_t a = 1, b = 0;
+    while (size > 0) {
+        //the sums cannot overflow over 5552 bytes
+        size_t n = std::min(size, size_t(5552));
+        for (size_t i = 0; i < n; ++i) {
+            a += bytes[i];
+            b += a;
+        }
+        a %= adler_base;
+        b %= adler_base;
+        bytes += n;
+        size -= n;
+    }
+    return b << 16 | a;
+}
+
+//! adler-32 of two byte strings one after the other, the second one of size bytes
+static uint32_t combineAdler32(uint32_t first, uint32_t second, size_t size) {
+    uint64_t a1 = first & 0xffff, b1 = first >> 16, a2 = second & 0xffff, b2 = second >> 16;
+    uint64_t a = (a1 + a2 + adler_base - 1) % adler_base;
+    uint64_t b = (b1 + b2 + (size % adler_base) * (a1 + adler_base - 1)) % adler_base;
+    return uint32_t(b << 16 | a);
+}
+
+//! slicing by 8 : entries[k][b] is the crc of byte b followed by k zeros
+typedef struct crc_table_s {
+    uint32_t entries[8][256];
+
+    crc_table_s() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            entries[0][i] = c;
+        }
+        for (int k = 1; k < 8; ++k)
+            for (uint32_t i = 0; i < 256; ++i) entries[k][i] = entries[0][entries[k - 1][i] & 0xff] ^ (entries[k - 1][i] >> 8);
+    }
+} CRCTable;
+
+//! crc of the bytes that crc was computed on followed by bytes, from 0
+static uint32_t crc32(uint32_t crc, const unsigned char *bytes, size_t size) {
+    static const CRCTable table;
+    uint32_t c = crc ^ 0xffffffffu;
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint32_t low = c ^ (uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24);
+        c = table.entries[7][low & 0xff] ^ table.entries[6][(low >> 8) & 0xff] ^ table.entries[5][(low >> 16) & 0xff]
+            ^ table.entries[4][low >> 24] ^ table.entries[3][bytes[4]] ^ table.entries[2][bytes[5]]
+            ^ table.entries[1][bytes[6]] ^ table.entries[0][bytes[7]];
+    }
+    for (size_t i = 0; i < size; ++i) c = table.entries[0][(c ^ bytes[i]) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffffu;
+}
+
+/* deflate */
+
+static const size_t deflate_window = 32768;
+static const unsigned deflate_hash_bits = 15;
+static const size_t min_match = 3, max_match = 258;
+//! symbols of a block, with their own Huffman codes
+static const size_t block_symbols = size_t(1) << 16;
+
+static const uint16_t length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83,
+                                         99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+                                           1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+                                           12, 12, 13, 13};
+//! order of the lengths of the code length codes in a block header
+static const uint8_t code_length_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+typedef struct deflate_codes_s {
+    uint8_t length[max_match + 1]; //! code of a match length, from 0 for symbol 257
+    uint8_t distance[512]; //! code of distance - 1 below 256, of 256 + (distance - 1) / 128 above
+
+    deflate_codes_s() {
+        for (uint8_t code = 0; code < 29; ++code)
+            for (size_t l = length_base[code]; l < length_base[code] + (size_t(1) << length_extra[code]) && l <= max_match; ++l)
+                length[l] = code;
+        for (uint8_t code = 0; code < 30; ++code)
+            for (size_t d = distance_base[code] - 1; d < distance_base[code] - 1 + (size_t(1) << distance_extra[code]); ++d)
+                distance[d < 256 ? d : 256 + (d >> 7)] = code;
+    }
+} DeflateCodes;
+
+static const DeflateCodes &deflateCodes() {
+    static const DeflateCodes codes;
+    return codes;
+}
+
+static unsigned distanceCode(const DeflateCodes &codes, size_t distance) {
+    return distance <= 256 ? codes.distance[distance - 1] : codes.distance[256 + ((distance - 1) >> 7)];
+}
+
+//! a literal byte, or a match : match_flag | length << 16 | distance - 1
+static const uint32_t match_flag = 0x80000000u;
+
+typedef struct bit_writer_s {
+    std::vector<unsigned char> *out;
+    uint64_t bits; //! the first ones to write in the low bits
+    unsigned count;
+} BitWriter;
+
+static void putBits(BitWriter &writer, uint32_t value, unsigned count) {
+    writer.bits |= uint64_t(value) << writer.count;
+    writer.count += count;
+    while (writer.count >= 8) {
+        writer.out->push_back((unsigned char)writer.bits);
+        writer.bits >>= 8;
+        writer.count -= 8;
+    }
+}
+
+static void alignBits(BitWriter &writer) {
+    if (writer.count > 0) writer.out->push_back((unsigned char)writer.bits);
+    writer.bits = 0;
+    writer.count = 0;
+}
+
+typedef struct huffman_code_s {
+    uint8_t lengths[288];
+    uint16_t codes[288]; //! bit reversed, deflate writes them from their first bit
+} HuffmanCode;
+
+//! lengths of a Huffman code of the symbols of freqs, none above maxBits : the frequencies are flattened
+//! until the code fits. at least two symbols get a code, so that decoders always see a complete code
+static void buildHuffmanCode(const uint32_t *freqs, size_t count, unsigned maxBits, HuffmanCode *code) {
+    std::vector<uint64_t> weights(freqs, freqs + count);
+    size_t used = count - size_t(std::count(weights.begin(), weights.end(), 0));
+    for (size_t i = 0; used < 2 && i < count; ++i)
+        if (weights[i] == 0) {
+            weights[i] = 1;
+            ++used;
+        }
+    std::vector<std::pair<uint64_t, size_t> > leaves;
+    std::vector<uint64_t> nodes;
+    std::vector<size_t> parents;
+    std::vector<unsigned> depths;
+    for (;;) {
+        leaves.clear();
+        for (size_t i = 0; i < count; ++i)
+            if (weights[i] > 0) leaves.push_back(std::make_pair(weights[i], i));
+        std::sort(leaves.begin(), leaves.end());
+        //leaves are nodes [0, n[, the merged ones [n, 2n - 1[ : they come in increasing weight, the root last
+        size_t n = leaves.size(), leaf = 0, merged = 0;
+        nodes.assign(n - 1, 0);
+        parents.assign(2 * n - 1, 0);
+        for (size_t k = 0; k + 1 < n; ++k) {
+            for (int child = 0; child < 2; ++child) {
+                size_t node;
+                if (leaf < n && (merged >= k || leaves[leaf].first <= nodes[merged])) {
+                    node = leaf;
+                    nodes[k] += leaves[leaf++].first;
+                } else {
+                    node = n + merged;
+                    nodes[k] += nodes[merged++];
+                }
+                parents[node] = n + k;
+            }
+        }
+        depths.assign(2 * n - 1, 0);
+        unsigned deepest = 0;
+        for (size_t i = 2 * n - 2; i-- > 0;) {
+            depths[i] = depths[parents[i]] + 1;
+            deepest = std::max(deepest, depths[i]);
+        }
+        if (deepest <= maxBits) {
+            memset(code->lengths, 0, sizeof(code->lengths));
+            for (size_t i = 0; i < n; ++i) code->lengths[leaves[i].second] = uint8_t(depths[i]);
+            break;
+        }
+        for (uint64_t &weight : weights) weight = (weight + 1) / 2;
+    }
+
+    //canonical codes, as RFC 1951 builds them back from the lengths
+    unsigned lengthCount[16] = {0}, next[16] = {0};
+    for (size_t i = 0; i < count; ++i) ++lengthCount[code->lengths[i]];
+    lengthCount[0] = 0;
+    for (unsigned bits = 1, c = 0; bits < 16; ++bits) {
+        c = (c + lengthCount[bits - 1]) << 1;
+        next[bits] = c;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        unsigned length = code->lengths[i], c = length ? next[length]++ : 0, reversed = 0;
+        for (unsigned b = 0; b < length; ++b) reversed |= ((c >> b) & 1) << (length - 1 - b);
+        code->codes[i] = uint16_t(reversed);
+    }
+}
+
+//! bytes in stored blocks of at most 65535 bytes, the last one final if final. none of size 0 is an empty
+//! block, which ends on a byte
+static void writeStored(BitWriter &writer, const unsigned char *bytes, size_t size, bool final) {
+    do {
+        size_t n = std::min(size, size_t(65535));
+        putBits(writer, final && n == size, 1);
+        putBits(writer, 0, 2);
+        alignBits(writer);
+        unsigned char header[4] = {(unsigned char)n, (unsigned char)(n >> 8), (unsigned char)~n, (unsigned char)(~n >> 8)};
+        writer.out->insert(writer.out->end(), header, header + 4);
+        writer.out->insert(writer.out->end(), bytes, bytes + n);
+        bytes += n;
+        size -= n;
+    } while (size > 0);
+}
+
+//! the symbols, which encode bytes, in a block with Huffman codes of their own, or stored if that is shorter
+static void writeBlock(BitWriter &writer, const std::vector<uint32_t> &symbols, const unsigned char *bytes, size_t size, bool final) {
+    const DeflateCodes &codes = deflateCodes();
+    uint32_t literalFreqs[286] = {0}, distanceFreqs[30] = {0};
+    literalFreqs[256] = 1;
+    for (uint32_t symbol : symbols) {
+        if (symbol & match_flag) {
+            ++literalFreqs[257 + codes.length[(symbol >> 16) & 0x1ff]];
+            ++distanceFreqs[distanceCode(codes, (symbol & 0x7fff) + 1)];
+        } else {
+            ++literalFreqs[symbol];
+        }
+    }
+    HuffmanCode literals, distances, lengths;
+    buildHuffmanCode(literalFreqs, 286, 15, &literals);
+    buildHuffmanCode(distanceFreqs, 30, 15, &distances);
+    size_t literalCount = 286, distanceCount = 30;
+    while (literalCount > 257 && literals.lengths[literalCount - 1] == 0) --literalCount;
+    while (distanceCount > 1 && distances.lengths[distanceCount - 1] == 0) --distanceCount;
+
+    //the code lengths of both codes, as runs : 16 repeats the previous length, 17 and 18 repeat zeros
+    uint8_t all[286 + 30];
+    memcpy(all, literals.lengths, literalCount);
+    memcpy(all + literalCount, distances.lengths, distanceCount);
+    size_t total = literalCount + distanceCount;
+    std::vector<std::pair<uint8_t, uint8_t> > runs; //! symbol and its extra bits
+    uint32_t lengthFreqs[19] = {0};
+    for (size_t i = 0; i < total;) {
+        uint8_t length = all[i];
+        size_t run = 1;
+        while (i + run < total && all[i + run] == length) ++run;
+        if (length == 0 && run >= 3) {
+            run = std::min(run, size_t(138));
+            runs.push_back(run >= 11 ? std::make_pair(uint8_t(18), uint8_t(run - 11)) : std::make_pair(uint8_t(17), uint8_t(run - 3)));
+            i += run;
+        } else {
+            runs.push_back(std::make_pair(length, uint8_t(0)));
+            size_t left = run - 1;
+            while (length != 0 && left >= 3) {
+                size_t repeat = std::min(left, size_t(6));
+                runs.push_back(std::make_pair(uint8_t(16), uint8_t(repeat - 3)));
+                left -= repeat;
+            }
+            i += run - (length != 0 ? left : run - 1);
+        }
+    }
+    for (const std::pair<uint8_t, uint8_t> &r : runs) ++lengthFreqs[r.first];
+    buildHuffmanCode(lengthFreqs, 19, 7, &lengths);
+    size_t lengthCount = 19;
+    while (lengthCount > 4 && lengths.lengths[code_length_order[lengthCount - 1]] == 0) --lengthCount;
+
+    static const uint8_t run_extra[19] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7};
+    uint64_t bits = 3 + 5 + 5 + 4 + 3 * lengthCount;
+    for (size_t i = 0; i < 19; ++i) bits += uint64_t(lengthFreqs[i]) * (lengths.lengths[i] + run_extra[i]);
+    for (size_t i = 0; i < 286; ++i) bits += uint64_t(literalFreqs[i]) * (literals.lengths[i] + (i > 256 ? length_extra[i - 257] : 0));
+    for (size_t i = 0; i < 30; ++i) bits += uint64_t(distanceFreqs[i]) * (distances.lengths[i] + distance_extra[i]);
+    if (8 * uint64_t(size) + 40 * (size / 65535 + 1) + 7 < bits) {
+        writeStored(writer, bytes, size, final);
+        return;
+    }
+
+    putBits(writer, final, 1);
+    putBits(writer, 2, 2);
+    putBits(writer, uint32_t(literalCount - 257), 5);
+    putBits(writer, uint32_t(distanceCount - 1), 5);
+    putBits(writer, uint32_t(lengthCount - 4), 4);
+    for (size_t i = 0; i < lengthCount; ++i) putBits(writer, lengths.lengths[code_length_order[i]], 3);
+    for (const std::pair<uint8_t, uint8_t> &r : runs) {
+        putBits(writer, lengths.codes[r.first], lengths.lengths[r.first]);
+        if (run_extra[r.first]) putBits(writer, r.second, run_extra[r.first]);
+    }
+    for (uint32_t symbol : symbols) {
+        if (symbol & match_flag) {
+            size_t length = (symbol >> 16) & 0x1ff, distance = (symbol & 0x7fff) + 1;
+            unsigned l = codes.length[length], d = distanceCode(codes, distance);
+            putBits(writer, literals.codes[257 + l], literals.lengths[257 + l]);
+            if (length_extra[l]) putBits(writer, uint32_t(length - length_base[l]), length_extra[l]);
+            putBits(writer, distances.codes[d], distances.lengths[d]);
+            if (distance_extra[d]) putBits(writer, uint32_t(distance - distance_base[d]), distance_extra[d]);
+        } else {
+            putBits(writer, literals.codes[symbol], literals.lengths[symbol]);
+        }
+    }
+    putBits(writer, literals.codes[256], literals.lengths[256]);
+}
+
+static uint32_t hash3(const unsigned char *bytes) {
+    uint32_t key = uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16;
+    return (key * 2654435761u) >> (32 - deflate_hash_bits);
+}
+
+//! bytes deflated on their own, appended to out. the last block is final if final, otherwise an empty
+//! stored block follows so that what comes next starts on a byte. matches are searched along chains of
+//! 2^(level - 1) earlier positions of the same hash
+static void deflateStripe(std::vector<unsigned char> *out, const unsigned char *bytes, size_t size, int level, bool final) {
+    BitWriter writer = {out, 0, 0};
+    if (level <= png_stored) {
+        writeStored(writer, bytes, size, final);
+        return;
+    }
+    size_t chain = size_t(1) << (std::min(level, png_best) - 1);
+    size_t nice = level >= png_best ? max_match : size_t(32 * level);
+    std::vector<int32_t> head(size_t(1) << deflate_hash_bits, -1), previous(deflate_window);
+    auto insert = [&](size_t pos) {
+        uint32_t h = hash3(bytes + pos);
+        previous[pos & (deflate_window - 1)] = head[h];
+        head[h] = int32_t(pos);
+    };
+
+    std::vector<uint32_t> symbols;
+    symbols.reserve(block_symbols);
+    size_t blockStart = 0;
+    for (size_t pos = 0; pos < size;) {
+        size_t best = 0, bestDistance = 0;
+        if (pos + min_match <= size) {
+            size_t limit = std::min(max_match, size - pos);
+            int32_t candidate = head[hash3(bytes + pos)];
+            for (size_t tries = chain; tries > 0 && candidate >= 0 && pos - size_t(candidate) <= deflate_window; --tries) {
+                const unsigned char *a = bytes + candidate, *b = bytes + pos;
+                if (a[best] == b[best]) {
+                    size_t length = 0;
+                    while (length < limit && a[length] == b[length]) ++length;
+                    if (length > best) {
+                        best = length;
+                        bestDistance = pos - size_t(candidate);
+                        if (length >= nice || length == limit) break;
+                    }
+                }
+                //entries older than the window may have been overwritten by later positions
+                int32_t next = previous[size_t(candidate) & (deflate_window - 1)];
+                if (next >= candidate) break;
+                candidate = next;
+            }
+            insert(pos);
+        }
+        if (best >= min_match) {
+            symbols.push_back(match_flag | uint32_t(best) << 16 | uint32_t(bestDistance - 1));
+            for (size_t i = pos + 1; i < pos + best && i + min_match <= size; ++i) insert(i);
+            pos += best;
+        } else {
+            symbols.push_back(bytes[pos]);
+            ++pos;
+        }
+        if (symbols.size() >= block_symbols) {
+            writeBlock(writer, symbols, bytes + blockStart, pos - blockStart, false);
+            symbols.clear();
+            blockStart = pos;
+        }
+    }
+    writeBlock(writer, symbols, bytes + blockStart, size - blockStart, final);
+    if (!final) writeStored(writer, NULL, 0, false);
+    alignBits(writer);
+}
+
+/* PNG */
+
+//! rows of a stripe, deflated by a thread
+static const size_t stripe_bytes = size_t(1) << 18;
+//! width and height are 31 bit in PNG, and cannot be 0
+static const size_t png_max_size = 0x7fffffff;
+
+static inline unsigned char paethPredictor(int a, int b, int c) {
+    int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+    return (unsigned char)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+//! the filter byte then the filtered bytes of row, in out. above is the previous row, zeros for the first one.
+//! the filter is the one whose bytes, taken as signed, sum the smallest, as libpng guesses.
+//! candidates hold 4 rows
+static void filterRow(unsigned char *out, const unsigned char *row, const unsigned char *above, size_t bytes, int level,
+                      unsigned char *candidates) {
+    out[0] = 0;
+    memcpy(out + 1, row, bytes);
+    if (level <= png_stored) return;
+    unsigned char *sub = candidates, *up = sub + bytes, *average = up + bytes, *paeth = average + bytes;
+    //a filter at a time, the first texel has none on its left
+    for (size_t i = 0; i < bytes; ++i) up[i] = (unsigned char)(row[i] - above[i]);
+    for (size_t i = 0; i < 3 && i < bytes; ++i) {
+        sub[i] = row[i];
+        average[i] = (unsigned char)(row[i] - (above[i] >> 1));
+        paeth[i] = (unsigned char)(row[i] - above[i]);
+    }
+    for (size_t i = 3; i < bytes; ++i) sub[i] = (unsigned char)(row[i] - row[i - 3]);
+    for (size_t i = 3; i < bytes; ++i) average[i] = (unsigned char)(row[i] - ((row[i - 3] + above[i]) >> 1));
+    for (size_t i = 3; i < bytes; ++i) paeth[i] = (unsigned char)(row[i] - paethPredictor(row[i - 3], above[i], above[i - 3]));
+    const unsigned char *filtered[5] = {row, sub, up, average, paeth};
+    size_t bestSum = 0;
+    int best = 0;
+    for (int filter = 0; filter < 5; ++filter) {
+        size_t sum = 0;
+        for (size_t i = 0; i < bytes; ++i) sum += size_t(abs(int((signed char)filtered[filter][i])));
+        if (filter == 0 || sum < bestSum) {
+            bestSum = sum;
+            best = filter;
+        }
+    }
+    out[0] = (unsigned char)best;
+    memcpy(out + 1, filtered[best], bytes);
+}
+
+static void put32(unsigned char *out, uint32_t value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+//! a chunk is its length, its type, its data and the crc of its type and data
+static void startChunk(std::vector<unsigned char> *chunk, const char *type) {
+    chunk->resize(4);
+    chunk->insert(chunk->end(), type, type + 4);
+}
+
+static void endChunk(std::vector<unsigned char> *chunk) {
+    put32(chunk->data(), uint32_t(chunk->size() - 8));
+    chunk->resize(chunk->size() + 4);
+    put32(&chunk->back() - 3, crc32(0, chunk->data() + 4, chunk->size() - 8));
+}
+
+bool encodePNG(std::vector<unsigned char> *png, const unsigned char *rgb, size_t width, size_t height, int level) {
+    if (width == 0 || height == 0 || width > png_max_size || height > png_max_size) return false;
+    size_t rowBytes = 3 * width;
+    size_t stripeRows = std::max(size_t(1), stripe_bytes / (rowBytes + 1));
+    size_t stripes = (height + stripeRows - 1) / stripeRows;
+    //every stripe is an IDAT chunk, they make a single zlib stream
+    std::vector<std::vector<unsigned char> > chunks(stripes);
+    std::vector<uint32_t> adlers(stripes);
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t s = 0; s < stripes; ++s) {
+        size_t first = s * stripeRows, last = std::min(height, first + stripeRows);
+        //the zeros above the first row follow the candidates
+        std::vector<unsigned char> filtered((last - first) * (rowBytes + 1)), candidates(5 * rowBytes, 0);
+        for (size_t y = first; y < last; ++y)
+            filterRow(&filtered[(y - first) * (rowBytes + 1)], rgb + y * rowBytes,
+                      y > 0 ? rgb + (y - 1) * rowBytes : &candidates[4 * rowBytes], rowBytes, level, candidates.data());
+        adlers[s] = adler32(filtered.data(), filtered.size());
+
+        std::vector<unsigned char> &chunk = chunks[s];
+        startChunk(&chunk, "IDAT");
+        if (s == 0) {
+            //32K window, and the level as zlib tells it
+            static const unsigned char zlib_headers[4][2] = {{0x78, 0x01}, {0x78, 0x5e}, {0x78, 0x9c}, {0x78, 0xda}};
+            int header = level <= png_fast ? 0 : level < png_default ? 1 : level == png_default ? 2 : 3;
+            chunk.insert(chunk.end(), zlib_headers[header], zlib_headers[header] + 2);
+        }
+        deflateStripe(&chunk, filtered.data(), filtered.size(), level, s + 1 == stripes);
+        if (s + 1 < stripes) endChunk(&chunk);
+    }
+    //the adler-32 of all the filtered rows ends the stream
+    uint32_t adler = adlers[0];
+    for (size_t s = 1; s < stripes; ++s)
+        adler = combineAdler32(adler, adlers[s], (std::min(height, (s + 1) * stripeRows) - s * stripeRows) * (rowBytes + 1));
+    std::vector<unsigned char> &lastChunk = chunks.back();
+    lastChunk.resize(lastChunk.size() + 4);
+    put32(&lastChunk.back() - 3, adler);
+    endChunk(&lastChunk);
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    png->insert(png->end(), signature, signature + 8);
+    //8 bit RGB, not interlaced
+    std::vector<unsigned char> header;
+    startChunk(&header, "IHDR");
+    header.resize(8 + 13);
+    put32(&header[8], uint32_t(width));
+    put32(&header[12], uint32_t(height));
+    header[16] = 8;
+    header[17] = 2;
+    endChunk(&header);
+    png->insert(png->end(), header.begin(), header.end());
+    for (const std::vector<unsigned char> &chunk : chunks) png->insert(png->end(), chunk.begin(), chunk.end());
+    std::vector<unsigned char> end;
+    startChunk(&end, "IEND");
+    endChunk(&end);
+    png->insert(png->end(), end.begin(), end.end());
+    return true;
+}
+
+bool writePNG(const char *filename, const unsigned char *rgb, size_t width, size_t height, int level) {
+    std::vector<unsigned char> png;
+    if (!encodePNG(&png, rgb, width, height, level)) {
+        fprintf(stderr, "Cannot write file %s : a PNG cannot be %zux%zu...\n", filename, width, height);
+        return false;
+    }
+    FILE *f = fopen(filename, "wb");
+    bool ok = f != NULL && fwrite(png.data(), 1, png.size(), f) == png.size();
+    if (f != NULL && fclose(f) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Cannot write file %s...\n", filename);
+    return ok;
+}
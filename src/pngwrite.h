@@ -0,0 +1,22 @@
+#ifndef __PNGWRITE_H__
+#define __PNGWRITE_H__
+
+#include <stddef.h>
+#include <vector>
+
+//! \file : PNG writer. the rows are filtered and deflated by stripes in parallel : every stripe is deflated
+//! in blocks of its own, which never refer to the bytes of another stripe
+
+//! compression levels, as zlib's. png_stored keeps the rows as they are, for intermediate frames
+static const int png_stored = 0;
+static const int png_fast = 1;
+static const int png_default = 6;
+static const int png_best = 9;
+
+//! PNG file of rgb, 8 bit RGB texels row after row from the top, appended to png.
+//! false (png untouched) if the image is empty or too large for PNG, which keeps sizes below 2^31
+bool encodePNG(std::vector<unsigned char> *png, const unsigned char *rgb, size_t width, size_t height, int level = png_default);
+//! false (with a message) if the image cannot be encoded or filename cannot be written
+bool writePNG(const char *filename, const unsigned char *rgb, size_t width, size_t height, int level = png_default);
+
+#endif
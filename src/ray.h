@@ -15,6 +15,11 @@ typedef struct ray_s {
     int sign[3]; //! sign of the x,y,z component of dir, 0 -> positive, 1->negative. To optimize aabb intersection
     vec3 invdir; //! =1/dir, optimize aabb
 
+    //! ray differentials (Igehy, "Tracing Ray Differentials", 1999) : change of orig and dir from one pixel
+    //! to the next, along x and y on the image. zero for rays that do not come from the camera (shadows)
+    vec3 dOdx, dOdy;
+    vec3 dDdx, dDdy;
+
 } Ray;
 
 inline void rayInit(Ray *r, point3 o, vec3 d, float tmin=0, float tmax=100000, int depth=0) {
@@ -27,6 +32,7 @@ inline void rayInit(Ray *r, point3 o, vec3 d, float tmin=0, float tmax=100000, i
     r->sign[1] = r->dir.y>=0?0:1;
     r->sign[2] = r->dir.z>=0?0:1;
     r->invdir = 1.f/d;
+    r->dOdx = r->dOdy = r->dDdx = r->dDdy = vec3(0.f);
 }
 
 inline point3 rayAt(const Ray r, float t) {
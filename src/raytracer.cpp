@@ -4,12 +4,14 @@
 #include "ray.h"
 #include "raytracer.h"
 #include "scene_types.h"
+#include "mesh.h"
+#include "heightfield.h"
 #include <stdio.h>
+#include <algorithm>
 
 #define GLM_ENABLE_EXPERIMENTAL
 
 #include <glm/gtc/epsilon.hpp>
-#include <glm/gtx/rotate_vector.hpp>
 #include <iostream>
 
 /// acne_eps is a small constant used to prevent acne when computing
@@ -25,8 +27,13 @@ bool findUVObject(const Intersection &intersection, float &u, float &v){
             findUVSphere(intersection, u, v);
             return true;
         case PLANE:
+        case BOX:
+        case DISK:
             findUVPlane(intersection, u, v);
             return true;
+        case HEIGHTFIELD:
+            findUVHeightfield(intersection, u, v);
+            return true;
         default:
             return false;
     }
@@ -49,14 +56,20 @@ void findUVSphere(const Intersection &intersection, float &u, float &v){
     v = V;
 }
 
-void findUVPlane(const Intersection &intersection, float &u, float &v){
-    vec3 a = cross(intersection.baseNormal, vec3(1.f,0.f,0.f));
-    vec3 b = cross(intersection.baseNormal, vec3(0.f,1.f,0.f));
-    vec3 c = cross(intersection.baseNormal, vec3(0.f,0.f,1.f));
+//! directions of u and v in the plane of normal n
+static void planeAxes(vec3 n, vec3 &U, vec3 &V){
+    vec3 a = cross(n, vec3(1.f,0.f,0.f));
+    vec3 b = cross(n, vec3(0.f,1.f,0.f));
+    vec3 c = cross(n, vec3(0.f,0.f,1.f));
     vec3 max_ab = dot(a,a) < dot(b,b) ? b : a;
 
-    vec3 U = normalize(dot(max_ab,max_ab) < dot(c,c) ? c : max_ab);
-    vec3 V = normalize(cross(intersection.baseNormal, U));
+    U = normalize(dot(max_ab,max_ab) < dot(c,c) ? c : max_ab);
+    V = normalize(cross(n, U));
+}
+
+void findUVPlane(const Intersection &intersection, float &u, float &v){
+    vec3 U, V;
+    planeAxes(intersection.baseNormal, U, V);
 
     u = dot(U, intersection.position);
     v = dot(V, intersection.position);
@@ -64,23 +77,70 @@ void findUVPlane(const Intersection &intersection, float &u, float &v){
     v -= floor(v);
 }
 
+void findUVHeightfield(const Intersection &intersection, float &u, float &v){
+    //mapped from above, as a horizontal plane would be
+    Intersection flat = intersection;
+    flat.baseNormal = vec3(0.f,1.f,0.f);
+    findUVPlane(flat, u, v);
+}
+
+//! change of (u, v) of the sphere mapping when its normal moves by dN, across the seam of u
+static void sphereUVDelta(const Intersection &intersection, float u, float v, vec3 dN, float &du, float &dv){
+    Intersection moved = intersection;
+    moved.baseNormal = normalize(intersection.baseNormal + dN);
+    float u1, v1;
+    findUVSphere(moved, u1, v1);
+    du = u1 - u;
+    dv = v1 - v;
+    du -= roundf(du);
+}
+
+bool findTexCoordObject(const Intersection &intersection, TexCoord *tc){
+    if (!findUVObject(intersection, tc->u, tc->v))
+        return false;
+    if (intersection.obj->geom.type == SPHERE) {
+        //the mapping bends : finite differences
+        sphereUVDelta(intersection, tc->u, tc->v, intersection.dNdx, tc->dudx, tc->dvdx);
+        sphereUVDelta(intersection, tc->u, tc->v, intersection.dNdy, tc->dudy, tc->dvdy);
+    } else {
+        //planar mappings are linear in the position
+        vec3 U, V;
+        planeAxes(intersection.obj->geom.type == HEIGHTFIELD ? vec3(0.f,1.f,0.f) : intersection.baseNormal, U, V);
+        tc->dudx = dot(U, intersection.dPdx);
+        tc->dvdx = dot(V, intersection.dPdx);
+        tc->dudy = dot(U, intersection.dPdy);
+        tc->dvdy = dot(V, intersection.dPdy);
+    }
+    return true;
+}
+
+//! tangent and bitangent of the frame that turns z onto the unit vector n the shortest way (the x and y axes
+//! rotated about z x n), upside down about x when n is -z
+static void tangentFrame(vec3 n, vec3 &tangent, vec3 &bitangent) {
+    if (n.z < -0.999999f) {
+        tangent = vec3(1.f, 0.f, 0.f);
+        bitangent = vec3(0.f, -1.f, 0.f);
+        return;
+    }
+    float a = 1.f / (1.f + n.z), b = -n.x * n.y * a;
+    tangent = vec3(1.f - n.x * n.x * a, b, -n.x);
+    bitangent = vec3(b, 1.f - n.y * n.y * a, -n.y);
+}
+
 void applyBumpTexSphere(Intersection *intersection) {
-    float U, V;
-    if (!intersection->mat->hasBumpTexture || !findUVObject(*intersection, U, V)){
+    if (!intersection->mat->hasBumpTexture || !intersection->hasTexCoord
+        || textureLevels(intersection->mat->bump_texture) == NULL){
         intersection->normal = intersection->baseNormal;
         return;
     }
 
-    auto x = (size_t) (U*float(intersection->mat->bump_texture->width));
-    auto y = (size_t) (V*float(intersection->mat->bump_texture->height));
-
-    vec3 map_n(*getPixelPtr(intersection->mat->bump_texture, x, y));
-    vec3 finalized_map_n(map_n.x-0.5f, map_n.y-0.5f, map_n.z);
-    finalized_map_n = normalize(finalized_map_n);
-    vec3 rot = cross(vec3(0.f,0.f,1.f), intersection->baseNormal);
-    float angle = acosf(dot(vec3(0.f,0.f,1.f), intersection->baseNormal));
-    vec3 ret = rotate(finalized_map_n, angle, rot);
-    intersection->normal = normalize(ret);
+    //unit normal in the tangent space, filtered. a map read as colors is decoded here
+    Texture *bump = intersection->mat->bump_texture;
+    vec3 map_n = sampleTexture(bump, intersection->texCoord);
+    if (bump->compression != TEXTURE_UNIT_NORMALS && bump->compression != TEXTURE_NORMAL_BLOCKS) map_n = unitNormal(map_n);
+    vec3 tangent, bitangent;
+    tangentFrame(intersection->baseNormal, tangent, bitangent);
+    intersection->normal = normalize(map_n.x * tangent + map_n.y * bitangent + map_n.z * intersection->baseNormal);
 }
 
 color3 applyImgTexObject(const Intersection &intersection){
@@ -89,14 +149,10 @@ color3 applyImgTexObject(const Intersection &intersection){
     }
 
 
-    float U, V;
-    if (!findUVObject(intersection, U, V))
+    if (!intersection.hasTexCoord || textureLevels(intersection.mat->image_texture) == NULL)
         return intersection.mat->diffuseColor;
 
-    auto x = (size_t) (U*float(intersection.mat->image_texture->width));
-    auto y = (size_t) (V*float(intersection.mat->image_texture->height));
-
-	return *getPixelPtr(intersection.mat->image_texture, x, y);
+    return sampleTexture(intersection.mat->image_texture, intersection.texCoord);
 }
 
 color3 applySpecTexObject(const Intersection &intersection){
@@ -104,14 +160,10 @@ color3 applySpecTexObject(const Intersection &intersection){
         return intersection.mat->specularColor;
     }
 
-    float U, V;
-    if (!findUVObject(intersection, U, V))
+    if (!intersection.hasTexCoord || textureLevels(intersection.mat->spec_texture) == NULL)
         return intersection.mat->specularColor;
 
-    auto x = (size_t) (U*float(intersection.mat->spec_texture->width));
-    auto y = (size_t) (V*float(intersection.mat->spec_texture->height));
-
-    return *getPixelPtr(intersection.mat->spec_texture, x, y);
+    return sampleTexture(intersection.mat->spec_texture, intersection.texCoord);
 }
 
 float applyRoughTexObject(const Intersection &intersection){
@@ -119,24 +171,16 @@ float applyRoughTexObject(const Intersection &intersection){
         return intersection.mat->roughness;
     }
 
-    float U, V;
-    if (!findUVObject(intersection, U, V))
+    if (!intersection.hasTexCoord || textureLevels(intersection.mat->rough_texture) == NULL)
         return intersection.mat->roughness;
 
-    auto x = (size_t) (U*float(intersection.mat->rough_texture->width));
-    auto y = (size_t) (V*float(intersection.mat->rough_texture->height));
-
-    color3 cp = *getPixelPtr(intersection.mat->rough_texture, x, y);
-    float c = (cp.x + cp.y + cp.z) * (1.f/3.f);
-    if (c == 0.0f){
-        return 0.7f;
-    }
-    float rough = (1.f/c) * 0.1f;
-    if (rough > 0.7f)   rough = 0.7f;
-    return rough;
+    //the map holds the roughness itself, a map read as colors is decoded here
+    Texture *rough = intersection.mat->rough_texture;
+    color3 c = sampleTexture(rough, intersection.texCoord);
+    return rough->compression == TEXTURE_ROUGHNESS ? c.x : roughnessAlpha(c);
 }
 
-bool intersectPlane(Ray *ray, Intersection *intersection, Object *obj) {
+bool intersectPlane(Ray *ray, Hit *hit, Object *obj) {
 	vec3 n = normalize(obj->geom.plane.normal);
 	float dist = obj->geom.plane.dist;
 	float coef = dot(ray->dir, n);
@@ -144,97 +188,529 @@ bool intersectPlane(Ray *ray, Intersection *intersection, Object *obj) {
 	float t = -(float(dot(ray->orig, n))+dist)/coef;
 	if (t <= ray->tmin || t > ray->tmax) return false;
 	ray->tmax = t;
-	intersection->position = ray->orig + t*ray->dir;
-	intersection->baseNormal = n;
-	intersection->mat = &obj->mat;
-    intersection->obj = obj;
-    applyBumpTexSphere(intersection);
+	hit->t = t;
+	hit->obj = obj;
+	hit->prim = 0;
 	return true;
 }
 
-bool intersectSphere(Ray *ray, Intersection *intersection, Object *obj) {
+bool intersectSphere(Ray *ray, Hit *hit, Object *obj) {
   vec3 dist = obj->geom.sphere.center-ray->orig;
   float b = dot(ray->dir, dist);
   float del = b*b - dot(dist, dist) + obj->geom.sphere.radius * obj->geom.sphere.radius;
   if (del > 0.0f){
 	  float t = (b - sqrtf(del));
 	  if (t >= ray->tmax) return false;
-	  vec3 pos = ray->orig + t*ray->dir;
-	  vec3 n = normalize(pos - obj->geom.sphere.center);
 	  if (t <= ray->tmin){
 		  t = (b + sqrtf(del));
 		  if (t <= ray->tmin || t > ray->tmax) return false;
-		  pos = ray->orig + t*ray->dir;
-		  n = normalize(obj->geom.sphere.center - pos);
 	  }
 	  ray->tmax = t;
-	  intersection->position = pos;
-	  intersection->baseNormal = normalize(n);
-	  intersection->mat = &obj->mat;
-      intersection->obj = obj;
-      applyBumpTexSphere(intersection); //edits normal
+	  hit->t = t;
+	  hit->obj = obj;
+	  hit->prim = 0;
 	  return true;
   }
   return false;
 }
 
-bool intersectTriangle(Ray *ray, Intersection *intersection, Object *triangle){
-    vec3 v0 = triangle->geom.triangle.v0;
-    vec3 v1 = triangle->geom.triangle.v1;
-    vec3 v2 = triangle->geom.triangle.v2;
-
-    //normal calculation
+//! Moller-Trumbore test against v0 v1 v2, the closest t in [ray->tmin, ray->tmax] and its barycentrics are returned
+static inline bool intersectTriangleVertices(const Ray *ray, vec3 v0, vec3 v1, vec3 v2, float *t, float *u, float *v){
     vec3 A = v0 - v2;
     vec3 B = v1 - v2;
-    vec3 N = normalize(cross(B,A));
     vec3 T = ray->orig - v2;
 
-    if (dot(N, ray->dir) == 0.0f)    return false;
-    else if (dot(N, ray->dir) > 0.0f)    N = -N;
     vec3 p = cross(ray->dir, B);
     vec3 q = cross(T, A);
 
-
     float det = dot(p, A);
     if (det == 0.0f) return false;
-    float u = (1.f/det)*dot(p, T);
-    if (u < 0.f) return false;
-    float v = (1.f/det)*dot(q, ray->dir);
-    if (v < 0.f || (u+v > 1.f)) return false;
-
-    float t = (1.f/det) * dot(q, B);
-    if (t < ray->tmin || t > ray->tmax)  return false;
-
-    intersection->normal = intersection->baseNormal = normalize(N);
-    intersection->position = rayAt(*ray, t);
-    intersection->mat = &triangle->mat;
-    intersection->obj = triangle;
+    float invdet = 1.f/det;
+    *u = invdet*dot(p, T);
+    if (*u < 0.f) return false;
+    *v = invdet*dot(q, ray->dir);
+    if (*v < 0.f || (*u+*v > 1.f)) return false;
+
+    *t = invdet * dot(q, B);
+    return *t >= ray->tmin && *t <= ray->tmax;
+}
+
+//! normal of the triangle, facing the direction dir comes from
+static vec3 triangleNormal(vec3 v0, vec3 v1, vec3 v2, vec3 dir){
+    vec3 N = normalize(cross(v1 - v2, v0 - v2));
+    if (dot(N, dir) > 0.0f)    N = -N;
+    return N;
+}
+
+bool intersectTriangle(Ray *ray, Hit *hit, Object *triangle){
+    float t, u, v;
+    if (!intersectTriangleVertices(ray, triangle->geom.triangle.v0, triangle->geom.triangle.v1, triangle->geom.triangle.v2, &t, &u, &v))
+        return false;
+
     ray->tmax = t;
+    hit->t = t;
+    hit->obj = triangle;
+    hit->prim = 0;
+    hit->u = u;
+    hit->v = v;
     return true;
 }
 
-bool intersectScene(const Scene *scene, Ray *ray, Intersection *intersection) {
+//! true if the segment [ray->tmin, ray->tmax] of ray crosses the box
+static bool intersectBounds(const Ray *ray, vec3 bmin, vec3 bmax){
+    vec3 t0 = (bmin - ray->orig) * ray->invdir;
+    vec3 t1 = (bmax - ray->orig) * ray->invdir;
+    vec3 tnear = min(t0, t1);
+    vec3 tfar = max(t0, t1);
+    float tin = fmaxf(fmaxf(tnear.x, tnear.y), fmaxf(tnear.z, ray->tmin));
+    float tout = fminf(fminf(tfar.x, tfar.y), fminf(tfar.z, ray->tmax));
+    return tin <= tout;
+}
+
+//! the ray is brought in the quantized space of the mesh without normalizing its direction, so t is the
+//! same in both spaces and vertices are tested right after their integer to float conversion.
+//! hit->prim indexes the triangles of the level, then its quads
+bool intersectMesh(Ray *ray, Hit *hit, Object *obj){
+    const Mesh *mesh = obj->geom.mesh.mesh;
+    const MeshLod &lod = mesh->lods[obj->geom.mesh.lod];
+    const mat3 &toLocal = obj->geom.mesh.toLocal;
+    vec3 invScale = 1.f / mesh->quantScale;
+    Ray local;
+    rayInit(&local, (toLocal * (ray->orig - obj->tranlation) - mesh->bmin) * invScale,
+            (toLocal * ray->dir) * invScale, ray->tmin, ray->tmax, ray->depth);
+    if (!intersectBounds(&local, vec3(0.f), (mesh->bmax - mesh->bmin) * invScale)) return false;
+
+    const uint16_t *p = lod.positions;
+    int prim = -1;
+    float t, u, v;
+    size_t triangleCount = lod.triangleCount;
+    for (size_t i = 0 ; i < triangleCount ; ++i){
+        const unsigned *f = lod.triangles + 3*i;
+        const uint16_t *p0 = p + 3*f[0], *p1 = p + 3*f[1], *p2 = p + 3*f[2];
+        if (intersectTriangleVertices(&local, vec3(p0[0], p0[1], p0[2]), vec3(p1[0], p1[1], p1[2]), vec3(p2[0], p2[1], p2[2]), &t, &u, &v)){
+            local.tmax = t;
+            prim = int(i);
+            hit->u = u;
+            hit->v = v;
+        }
+    }
+    for (size_t i = 0 ; i < lod.quadCount ; ++i){
+        const unsigned *f = lod.quads + 4*i;
+        const uint16_t *p0 = p + 3*f[0], *p1 = p + 3*f[1], *p2 = p + 3*f[2], *p3 = p + 3*f[3];
+        if (intersectBilinearPatch(&local, vec3(p0[0], p0[1], p0[2]), vec3(p1[0], p1[1], p1[2]), vec3(p2[0], p2[1], p2[2]), vec3(p3[0], p3[1], p3[2]), &t, &u, &v)){
+            local.tmax = t;
+            prim = int(triangleCount + i);
+            hit->u = u;
+            hit->v = v;
+        }
+    }
+    if (prim < 0) return false;
+
+    ray->tmax = local.tmax;
+    hit->t = local.tmax;
+    hit->obj = obj;
+    hit->prim = prim;
+    return true;
+}
+
+//! the ray is brought in grid space (one unit per cell, heights in [0,1]) and the min-max pyramid is
+//! traversed front to back, skipping the nodes whose height range it misses. cells are bilinear patches
+//! between their four samples, hit->prim is the index of the cell
+bool intersectHeightfield(Ray *ray, Hit *hit, Object *obj){
+    typedef struct { int level; size_t x, z; } Node;
+    const Heightfield *hf = obj->geom.heightfield.data;
+    vec3 scale = vec3(float(hf->cellsX), 1.f, float(hf->cellsZ)) / obj->geom.heightfield.size;
+    Ray local;
+    rayInit(&local, (ray->orig - obj->geom.heightfield.origin) * scale, ray->dir * scale, ray->tmin, ray->tmax, ray->depth);
+
+    //children of a node are visited from the one nearest to the ray origin
+    size_t firstX = local.dir.x >= 0.f ? 0 : 1;
+    size_t firstZ = local.dir.z >= 0.f ? 0 : 1;
+
+    Node stack[4 * HEIGHTFIELD_MAX_LEVELS];
+    int top = 0;
+    stack[top++] = {hf->levelCount - 1, 0, 0};
+    int prim = -1;
+    float t, u, v;
+    while (top > 0){
+        Node n = stack[--top];
+        size_t span = size_t(1) << n.level;
+        vec2 range = heightfieldNode(hf, n.level, n.x, n.z);
+        vec3 bmin(float(n.x * span), range.x, float(n.z * span));
+        vec3 bmax(float(std::min((n.x + 1) * span, hf->cellsX)), range.y, float(std::min((n.z + 1) * span, hf->cellsZ)));
+        if (!intersectBounds(&local, bmin, bmax)) continue;
+
+        if (n.level == 0){
+            float x = float(n.x), z = float(n.z);
+            vec3 q00(x, heightfieldSample(hf, n.x, n.z), z);
+            vec3 q10(x + 1.f, heightfieldSample(hf, n.x + 1, n.z), z);
+            vec3 q11(x + 1.f, heightfieldSample(hf, n.x + 1, n.z + 1), z + 1.f);
+            vec3 q01(x, heightfieldSample(hf, n.x, n.z + 1), z + 1.f);
+            if (intersectBilinearPatch(&local, q00, q10, q11, q01, &t, &u, &v)){
+                local.tmax = t;
+                prim = int(n.z * hf->cellsX + n.x);
+                hit->u = u;
+                hit->v = v;
+            }
+            continue;
+        }
+
+        //farthest child pushed first
+        for (int k = 3 ; k >= 0 ; --k){
+            size_t cx = 2 * n.x + (size_t(k & 1) ^ firstX);
+            size_t cz = 2 * n.z + (size_t(k >> 1) ^ firstZ);
+            if (cx < hf->levelWidth[n.level - 1] && cz < hf->levelHeight[n.level - 1])
+                stack[top++] = {n.level - 1, cx, cz};
+        }
+    }
+    if (prim < 0) return false;
+
+    ray->tmax = local.tmax;
+    hit->t = local.tmax;
+    hit->obj = obj;
+    hit->prim = prim;
+    return true;
+}
+
+// from Reshetov, "Cool Patches: A Geometric Approach to Ray/Bilinear Patch Intersections", Ray Tracing Gems, 2019
+// solves the quadratic in u given by the two planes containing the ray, then gets v and t on the patch isoline.
+bool intersectBilinearPatch(const Ray *ray, vec3 q00, vec3 q10, vec3 q11, vec3 q01, float *t, float *u, float *v) {
+    vec3 e10 = q10 - q00;
+    vec3 e11 = q11 - q10;
+    vec3 e00 = q01 - q00;
+    vec3 qn = cross(e10, q01 - q11);
+    q00 -= ray->orig;
+    q10 -= ray->orig;
+    float a = dot(cross(q00, ray->dir), e00);
+    float c = dot(qn, ray->dir);
+    float b = dot(cross(q10, ray->dir), e11);
+    b -= a + c;
+    float det = b*b - 4.f*a*c;
+    if (det < 0.f) return false;
+    det = sqrtf(det);
+
+    float u1, u2;
+    if (c == 0.f) {
+        //planar, or trapezoid seen along its parallel sides : linear equation
+        if (b == 0.f) return false;
+        u1 = -a / b;
+        u2 = -1.f;
+    } else {
+        u1 = (-b - copysignf(det, b)) * 0.5f;
+        u2 = a / u1;
+        u1 /= c;
+    }
+
+    bool found = false;
+    float us[2] = {u1, u2};
+    for (float uc : us) {
+        if (uc < 0.f || uc > 1.f) continue;
+        vec3 pa = mix(q00, q10, uc);
+        vec3 pb = mix(e00, e11, uc);
+        vec3 n = cross(ray->dir, pb);
+        float len = dot(n, n);
+        if (len == 0.f) continue;
+        n = cross(n, pa);
+        float tc = dot(n, pb) / len;
+        float vc = dot(n, ray->dir) / len;
+        if (vc < 0.f || vc > 1.f || tc <= ray->tmin || tc > ray->tmax) continue;
+        if (found && tc >= *t) continue;
+        *t = tc;
+        *u = uc;
+        *v = vc;
+        found = true;
+    }
+    return found;
+}
+
+vec3 bilinearPatchNormal(vec3 q00, vec3 q10, vec3 q11, vec3 q01, float u, float v) {
+    vec3 du = mix(q10 - q00, q11 - q01, v);
+    vec3 dv = mix(q01 - q00, q11 - q10, u);
+    return cross(du, dv);
+}
+
+bool intersectQuad(Ray *ray, Hit *hit, Object *quad) {
+    float t, u, v;
+    if (!intersectBilinearPatch(ray, quad->geom.quad.v00, quad->geom.quad.v10, quad->geom.quad.v11, quad->geom.quad.v01, &t, &u, &v))
+        return false;
+    ray->tmax = t;
+    hit->t = t;
+    hit->obj = quad;
+    hit->prim = 0;
+    hit->u = u;
+    hit->v = v;
+    return true;
+}
+
+//! the box is intersected in its own frame with the slab method, hit->prim is the axis of the hit face
+bool intersectBox(Ray *ray, Hit *hit, Object *box) {
+    vec3 orig = ray->orig - box->geom.box.center;
+    vec3 invdir = ray->invdir;
+    if (!box->geom.box.aligned) {
+        mat3 toLocal = transpose(box->orientation);
+        orig = toLocal * orig;
+        invdir = 1.f / (toLocal * ray->dir);
+    }
+    vec3 h = box->geom.box.halfSize;
+    vec3 t0 = (-h - orig) * invdir;
+    vec3 t1 = (h - orig) * invdir;
+    vec3 tnear = min(t0, t1);
+    vec3 tfar = max(t0, t1);
+
+    int nearAxis = tnear.x > tnear.y ? (tnear.x > tnear.z ? 0 : 2) : (tnear.y > tnear.z ? 1 : 2);
+    int farAxis = tfar.x < tfar.y ? (tfar.x < tfar.z ? 0 : 2) : (tfar.y < tfar.z ? 1 : 2);
+    float tin = tnear[nearAxis];
+    float tout = tfar[farAxis];
+    if (tin > tout) return false;
+
+    float t = tin;
+    int axis = nearAxis;
+    if (t <= ray->tmin) {
+        //the ray starts inside the box
+        t = tout;
+        axis = farAxis;
+    }
+    if (t <= ray->tmin || t > ray->tmax) return false;
+    ray->tmax = t;
+    hit->t = t;
+    hit->obj = box;
+    hit->prim = axis;
+    return true;
+}
+
+//! hit->prim is 0 for the side, 1 for the bottom cap and 2 for the top cap
+bool intersectCylinder(Ray *ray, Hit *hit, Object *cylinder) {
+    vec3 a = cylinder->geom.cylinder.axis;
+    float r2 = cylinder->geom.cylinder.radius * cylinder->geom.cylinder.radius;
+    float height = cylinder->geom.cylinder.height;
+    vec3 oc = ray->orig - cylinder->geom.cylinder.base;
+    float oa = dot(oc, a);
+    float da = dot(ray->dir, a);
+
+    float tbest = ray->tmax;
+    int part = -1;
+
+    //side : quadratic on the components orthogonal to the axis
+    vec3 dp = ray->dir - da * a;
+    vec3 op = oc - oa * a;
+    float A = dot(dp, dp);
+    if (A > 0.f) {
+        float B = dot(dp, op);
+        float C = dot(op, op) - r2;
+        float del = B*B - A*C;
+        if (del > 0.f) {
+            float sq = sqrtf(del);
+            float roots[2] = {(-B - sq) / A, (-B + sq) / A};
+            for (float t : roots) {
+                float y = oa + t * da;
+                if (t > ray->tmin && t <= tbest && y >= 0.f && y <= height) {
+                    tbest = t;
+                    part = 0;
+                    break;
+                }
+            }
+        }
+    }
+
+    //caps
+    if (da != 0.f) {
+        float caps[2] = {0.f, height};
+        for (int i = 0 ; i < 2 ; ++i) {
+            float t = (caps[i] - oa) / da;
+            if (t > ray->tmin && t <= tbest) {
+                vec3 p = op + t * dp;
+                if (dot(p, p) <= r2) {
+                    tbest = t;
+                    part = i + 1;
+                }
+            }
+        }
+    }
+
+    if (part < 0) return false;
+    ray->tmax = tbest;
+    hit->t = tbest;
+    hit->obj = cylinder;
+    hit->prim = part;
+    return true;
+}
+
+bool intersectDisk(Ray *ray, Hit *hit, Object *disk) {
+    vec3 n = disk->geom.disk.normal;
+    float coef = dot(ray->dir, n);
+    if (coef == 0.0f) return false;
+    float t = dot(disk->geom.disk.center - ray->orig, n) / coef;
+    if (t <= ray->tmin || t > ray->tmax) return false;
+    vec3 p = rayAt(*ray, t) - disk->geom.disk.center;
+    if (dot(p, p) > disk->geom.disk.radius * disk->geom.disk.radius) return false;
+    ray->tmax = t;
+    hit->t = t;
+    hit->obj = disk;
+    hit->prim = 0;
+    return true;
+}
+
+static bool intersectObject(Ray *ray, Hit *hit, Object *obj) {
+    switch(obj->geom.type){
+        case PLANE:
+            return intersectPlane(ray, hit, obj);
+        case SPHERE:
+            return intersectSphere(ray, hit, obj);
+        case TRIANGLE:
+            return intersectTriangle(ray, hit, obj);
+        case QUAD:
+            return intersectQuad(ray, hit, obj);
+        case MESH:
+            return intersectMesh(ray, hit, obj);
+        case HEIGHTFIELD:
+            return intersectHeightfield(ray, hit, obj);
+        case BOX:
+            return intersectBox(ray, hit, obj);
+        case CYLINDER:
+            return intersectCylinder(ray, hit, obj);
+        case DISK:
+            return intersectDisk(ray, hit, obj);
+    }
+    return false;
+}
+
+bool intersectScene(const Scene *scene, Ray *ray, Hit *hit) {
 	bool hasIntersection = false;
 	size_t objectCount = scene->objects.size();
 	for (size_t i = 0 ; i < objectCount ; ++i){
-		switch(scene->objects[i]->geom.type){
-            case PLANE:
-                if (intersectPlane(ray, intersection, scene->objects[i]))
-                    hasIntersection = true;
-                break;
-            case SPHERE:
-                if (intersectSphere(ray, intersection, scene->objects[i]))
-                    hasIntersection = true;
-                break;
-		    case TRIANGLE:
-		        if (intersectTriangle(ray, intersection, scene->objects[i]))
-		            hasIntersection = true;
-		        break;
-		}
+		if (intersectObject(ray, hit, scene->objects[i]))
+			hasIntersection = true;
 	}
 	return hasIntersection;
 }
 
+bool occludedScene(const Scene *scene, Ray *ray) {
+	Hit dummy;
+	size_t objectCount = scene->objects.size();
+	for (size_t i = 0 ; i < objectCount ; ++i){
+		if (intersectObject(ray, &dummy, scene->objects[i]))
+			return true;
+	}
+	return false;
+}
+
+void computeIntersection(const Ray *ray, const Hit *hit, Intersection *intersection) {
+    Object *obj = hit->obj;
+    intersection->position = rayAt(*ray, hit->t);
+    intersection->mat = &obj->mat;
+    intersection->obj = obj;
+    switch(obj->geom.type){
+        case PLANE:
+            intersection->baseNormal = normalize(obj->geom.plane.normal);
+            break;
+        case SPHERE: {
+            vec3 n = normalize(intersection->position - obj->geom.sphere.center);
+            //the ray leaves the sphere : the normal points inward
+            if (dot(n, ray->dir) > 0.0f) n = -n;
+            intersection->baseNormal = n;
+            break;
+        }
+        case TRIANGLE:
+            intersection->baseNormal = triangleNormal(obj->geom.triangle.v0, obj->geom.triangle.v1, obj->geom.triangle.v2, ray->dir);
+            break;
+        case MESH: {
+            const Mesh *mesh = obj->geom.mesh.mesh;
+            const MeshLod *lod = &mesh->lods[obj->geom.mesh.lod];
+            size_t triangleCount = lod->triangleCount;
+            vec3 n;
+            if (size_t(hit->prim) < triangleCount) {
+                const unsigned *f = lod->triangles + 3*hit->prim;
+                vec3 p0 = meshVertex(mesh, lod, f[0]), p1 = meshVertex(mesh, lod, f[1]), p2 = meshVertex(mesh, lod, f[2]);
+                n = cross(p1 - p2, p0 - p2);
+            } else {
+                const unsigned *f = lod->quads + 4*(hit->prim - triangleCount);
+                n = bilinearPatchNormal(meshVertex(mesh, lod, f[0]), meshVertex(mesh, lod, f[1]),
+                                        meshVertex(mesh, lod, f[2]), meshVertex(mesh, lod, f[3]), hit->u, hit->v);
+            }
+            //normals transform with the inverse transpose of the orientation
+            n = normalize(transpose(obj->geom.mesh.toLocal) * n);
+            if (dot(n, ray->dir) > 0.0f) n = -n;
+            intersection->baseNormal = n;
+            break;
+        }
+        case QUAD: {
+            vec3 N = normalize(bilinearPatchNormal(obj->geom.quad.v00, obj->geom.quad.v10, obj->geom.quad.v11, obj->geom.quad.v01, hit->u, hit->v));
+            if (dot(N, ray->dir) > 0.0f)    N = -N;
+            intersection->baseNormal = N;
+            break;
+        }
+        case HEIGHTFIELD: {
+            const Heightfield *hf = obj->geom.heightfield.data;
+            size_t x = size_t(hit->prim) % hf->cellsX, z = size_t(hit->prim) / hf->cellsX;
+            float fx = float(x), fz = float(z);
+            vec3 n = bilinearPatchNormal(vec3(fx, heightfieldSample(hf, x, z), fz),
+                                         vec3(fx + 1.f, heightfieldSample(hf, x + 1, z), fz),
+                                         vec3(fx + 1.f, heightfieldSample(hf, x + 1, z + 1), fz + 1.f),
+                                         vec3(fx, heightfieldSample(hf, x, z + 1), fz + 1.f), hit->u, hit->v);
+            //grid to world is a scale : normals get the inverse scale of grid space
+            vec3 scale = vec3(float(hf->cellsX), 1.f, float(hf->cellsZ)) / obj->geom.heightfield.size;
+            n = normalize(n * scale);
+            if (dot(n, ray->dir) > 0.0f) n = -n;
+            intersection->baseNormal = n;
+            break;
+        }
+        case BOX: {
+            vec3 local = transpose(obj->orientation) * (intersection->position - obj->geom.box.center);
+            vec3 n = obj->orientation[hit->prim] * (local[hit->prim] > 0.f ? 1.f : -1.f);
+            if (dot(n, ray->dir) > 0.0f) n = -n;
+            intersection->baseNormal = n;
+            break;
+        }
+        case CYLINDER: {
+            vec3 a = obj->geom.cylinder.axis;
+            vec3 n;
+            if (hit->prim == 0) {
+                vec3 v = intersection->position - obj->geom.cylinder.base;
+                n = normalize(v - dot(v, a) * a);
+            } else {
+                n = hit->prim == 1 ? -a : a;
+            }
+            if (dot(n, ray->dir) > 0.0f) n = -n;
+            intersection->baseNormal = n;
+            break;
+        }
+        case DISK: {
+            vec3 n = obj->geom.disk.normal;
+            if (dot(n, ray->dir) > 0.0f) n = -n;
+            intersection->baseNormal = n;
+            break;
+        }
+    }
+
+    //the ray differentials reach the tangent plane of the hit
+    vec3 n = intersection->baseNormal;
+    float DdotN = dot(ray->dir, n);
+    vec3 dPx = ray->dOdx + hit->t * ray->dDdx, dPy = ray->dOdy + hit->t * ray->dDdy;
+    if (DdotN != 0.f) {
+        dPx -= dot(dPx, n) / DdotN * ray->dir;
+        dPy -= dot(dPy, n) / DdotN * ray->dir;
+    }
+    intersection->dPdx = dPx;
+    intersection->dPdy = dPy;
+    if (obj->geom.type == SPHERE) {
+        //the normal follows the position, scaled by the curvature (an inward normal turns the other way)
+        float curvature = (dot(n, intersection->position - obj->geom.sphere.center) > 0.f ? 1.f : -1.f) / obj->geom.sphere.radius;
+        intersection->dNdx = curvature * dPx;
+        intersection->dNdy = curvature * dPy;
+    } else {
+        intersection->dNdx = intersection->dNdy = vec3(0.f);
+    }
+
+    //everything the textures give, once for every light
+    const Material *mat = intersection->mat;
+    intersection->hasTexCoord = (mat->hasImgTexture || mat->hasBumpTexture || mat->hasSpecTexture || mat->hasRoughTexture)
+                                && findTexCoordObject(*intersection, &intersection->texCoord);
+    applyBumpTexSphere(intersection); //edits normal
+    intersection->diffuseColor = applyImgTexObject(*intersection);
+    intersection->specularColor = applySpecTexObject(*intersection);
+    intersection->roughness = applyRoughTexObject(*intersection);
+}
+
 /* ---------------------------------------------------------------------------
  */
 /*
@@ -308,17 +784,17 @@ float RDM_Smith(float LdotH, float LdotN, float VdotH, float VdotN,
 color3 RDM_bsdf_s(float LdotH, float NdotH, float VdotH, float LdotN,
                   float VdotN, Intersection *i) {
 
-    float roughness = applyRoughTexObject(*i);
+    float roughness = i->roughness;
   float D = RDM_Beckmann(NdotH, roughness);
   float F = RDM_Fresnel(LdotH, 1.0f, i->mat->IOR);
   float G = RDM_Smith(LdotH, LdotN, VdotH, VdotN, roughness);
 
-  return applySpecTexObject(*i) * ((D*F*G)/(4.0f*LdotN*VdotN));
+  return i->specularColor * ((D*F*G)/(4.0f*LdotN*VdotN));
 
 }
 // diffuse term of the cook torrance bsdf
 color3 RDM_bsdf_d(Intersection *i) {
-    return (1.f-i->mat->transparency) * applyImgTexObject(*i) * (1.0f/glm::pi<float>());
+    return (1.f-i->mat->transparency) * i->diffuseColor * (1.0f/glm::pi<float>());
 }
 
 // The full evaluation of bsdf(wi, wo) * cos (thetai)
@@ -347,25 +823,52 @@ color3 shade(vec3 n, vec3 v, vec3 l, color3 lc, Intersection *inter) {
     return lc * RDM_bsdf(LdotH, NdotH, VdotH, LdotN, VdotN, inter) * LdotN;
 }
 
+//! differentials of reflected, mirror of ray around the normal n of intersection
+static void reflectDifferentials(const Ray *ray, const Intersection &intersection, vec3 n, Ray *reflected) {
+    float DdotN = dot(ray->dir, n);
+    float dDNdx = dot(ray->dDdx, n) + dot(ray->dir, intersection.dNdx);
+    float dDNdy = dot(ray->dDdy, n) + dot(ray->dir, intersection.dNdy);
+    reflected->dOdx = intersection.dPdx;
+    reflected->dOdy = intersection.dPdy;
+    reflected->dDdx = ray->dDdx - 2.f * (DdotN * intersection.dNdx + dDNdx * n);
+    reflected->dDdy = ray->dDdy - 2.f * (DdotN * intersection.dNdy + dDNdy * n);
+}
+
+//! differentials of refracted, ray bent through the normal n of intersection with the ratio of indices eta
+static void refractDifferentials(const Ray *ray, const Intersection &intersection, vec3 n, float eta, Ray *refracted) {
+    float DdotN = dot(ray->dir, n), TdotN = dot(refracted->dir, n);
+    if (TdotN == 0.f) return;
+    //refracted->dir = eta * ray->dir - mu * n
+    float mu = eta * DdotN - TdotN;
+    float dmu = eta - eta * eta * DdotN / TdotN;
+    float dDNdx = dot(ray->dDdx, n) + dot(ray->dir, intersection.dNdx);
+    float dDNdy = dot(ray->dDdy, n) + dot(ray->dir, intersection.dNdy);
+    refracted->dOdx = intersection.dPdx;
+    refracted->dOdy = intersection.dPdy;
+    refracted->dDdx = eta * ray->dDdx - (mu * intersection.dNdx + dmu * dDNdx * n);
+    refracted->dDdy = eta * ray->dDdy - (mu * intersection.dNdy + dmu * dDNdy * n);
+}
+
 //! if tree is not null, use intersectKdTree to compute the intersection instead
 //! of intersect scene
 
 color3 trace_ray(Scene *scene, Ray *ray, KdTree *tree, float reflCoef) {
     color3 ret = color3(0.0f);
+    Hit hit;
     Intersection intersection;
     Ray shadow;
     Ray reflectedRay;
     Ray transmittedRay;
 
-	if (intersectScene(scene, ray, &intersection)){
+	if (intersectScene(scene, ray, &hit)){
+	    computeIntersection(ray, &hit, &intersection);
 	    for (auto &light : scene->lights) {
 		    vec3 dist = (light->position - intersection.position);
 		    float t = length(dist);
 		    vec3 l = normalize(dist);
 		    vec3 shadowOrig = intersection.position + acne_eps * l;
 		    rayInit(&shadow, shadowOrig, l, 0.f, t, ray->depth);
-		    Intersection dummy;
-            if (!intersectScene(scene, &shadow, &dummy)) {
+            if (!occludedScene(scene, &shadow)) {
                 ret += shade(intersection.normal, -ray->dir, l, light->color, &intersection);
             }
 		}
@@ -376,6 +879,7 @@ color3 trace_ray(Scene *scene, Ray *ray, KdTree *tree, float reflCoef) {
 			    vec3 reflectDir = normalize(reflect(ray->dir, intersection.normal));
 			    vec3 reflectOrig = intersection.position + acne_eps * reflectDir;
 			    rayInit(&reflectedRay, reflectOrig, reflectDir, 0.f, 10000.f, ray->depth+1);
+			    reflectDifferentials(ray, intersection, intersection.normal, &reflectedRay);
 			    float Fr = RDM_Fresnel(dot(reflectDir, intersection.normal), 1.0f, intersection.mat->IOR);
 			    ret += (1.f - transparency) * Fr * trace_ray(scene, &reflectedRay, tree, reflCoef*0.5f) * intersection.mat->specularColor * reflCoef;
 		    }
@@ -384,6 +888,7 @@ color3 trace_ray(Scene *scene, Ray *ray, KdTree *tree, float reflCoef) {
 			    vec3 refractDir = normalize(glm::refract(ray->dir, intersection.normal, 1.f/intersection.mat->IOR));
 			    vec3 refractOrig = intersection.position + acne_eps * refractDir;
 			    rayInit(&transmittedRay, refractOrig, refractDir, 0.f, 10000.f, ray->depth+1);
+			    refractDifferentials(ray, intersection, intersection.normal, 1.f/intersection.mat->IOR, &transmittedRay);
 			    ret += transparency * trace_ray(scene, &transmittedRay, tree, reflCoef*0.5f)*intersection.mat->specularColor;
 	        }
 
@@ -404,6 +909,8 @@ void renderImage(Image *img, Scene *scene) {
 
   KdTree *tree = NULL;
 
+  selectMeshLods(scene, img->width);
+
 
 //! \todo initialize KdTree
 
@@ -441,6 +948,11 @@ void renderImage(Image *img, Scene *scene) {
               vec3 ray_dir = center + (float(i)+ai) * dx + (float(j)+aj) * dy;
 
               rayInit(&rx, scene->cam.position, normalize(ray_dir));
+              //derivative of the normalized direction, for a step of one sample
+              float len2 = dot(ray_dir, ray_dir);
+              float invLen3 = 1.f / (len2 * sqrtf(len2) * float(nb_rays));
+              rx.dDdx = (len2 * dx - dot(ray_dir, dx) * ray_dir) * invLen3;
+              rx.dDdy = (len2 * dy - dot(ray_dir, dy) * ray_dir) * invLen3;
               *ptr += trace_ray(scene, &rx, tree, 1.0f);
           }
       }
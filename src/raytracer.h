@@ -5,6 +5,7 @@
 #include "image.h"
 #include "scene.h"
 #include "ray.h"
+#include "texture.h"
 
 
 
@@ -13,29 +14,61 @@ typedef struct intersection_s {
   vec3 normal; //! the normal of the intersection point
   vec3 baseNormal;
   point3 position; //! the intersection point
+  vec3 dPdx, dPdy; //! change of position from one pixel to the next, on the surface (from the ray differentials)
+  vec3 dNdx, dNdy; //! change of baseNormal likewise, where the surface is curved (spheres only)
   Material *mat; //! the material of th intersected object
   Object *obj;
+  TexCoord texCoord; //! looked for once, when the material has a texture
+  bool hasTexCoord;
+  color3 diffuseColor; //! parameters of the material at the intersection point, textures applied,
+  color3 specularColor; //! read by the bsdf for every light
+  float roughness;
 } Intersection;
 
+//! A hit is the minimal record kept while looking for the closest intersection,
+//! the shading attributes (Intersection) are computed once from it, after traversal.
+typedef struct hit_s {
+  float t; //! ray parameter of the hit
+  Object *obj; //! the intersected object
+  int prim; //! index of the intersected primitive inside obj (0 for single primitive objects)
+  float u, v; //! barycentric (or parametric) coordinates of the hit on the primitive
+} Hit;
 
 
-/// test the ray intersection against each object of the scene, the nearest intersection
-// is stored in the parameter intersection
+
+/// test the ray intersection against each object of the scene, the nearest hit
+// is stored in the parameter hit
 // Possible intersection are considered only between ray->tmin and ray->tmax
 // ray->tmax is updated during this process
 color3 applyImgTexObject(const Intersection &intersection);
 color3 applySpecTexObject(const Intersection &intersection);
 float applyRoughTexObject(const Intersection &intersection);
 bool findUVObject(const Intersection &intersection, float &u, float &v);
+//! texture coordinates of the intersection and their change from one pixel to the next, false without a mapping
+bool findTexCoordObject(const Intersection &intersection, TexCoord *tc);
 void findUVSphere(const Intersection &intersection, float &u, float &v);
 void findUVPlane(const Intersection &intersection, float &u, float &v);
+void findUVHeightfield(const Intersection &intersection, float &u, float &v);
 void applyBumpTexSphere(Intersection *intersection);
 
-bool intersectScene(const Scene *scene, Ray *ray, Intersection *intersection );
-bool intersectCylinder (Ray *ray, Intersection *intersection, Object *cylinder);
-bool intersectPlane(Ray *ray, Intersection *intersection, Object *plane);
-bool intersectSphere(Ray *ray, Intersection *intersection, Object *sphere);
-bool intersectTriangle(Ray *ray, Intersection *intersection, Object *triangle);
+bool intersectScene(const Scene *scene, Ray *ray, Hit *hit);
+//! true as soon as any object is found between ray->tmin and ray->tmax (shadow rays)
+bool occludedScene(const Scene *scene, Ray *ray);
+//! fill the shading attributes (position, normals, material) of the hit found on ray
+void computeIntersection(const Ray *ray, const Hit *hit, Intersection *intersection);
+bool intersectBox(Ray *ray, Hit *hit, Object *box);
+bool intersectCylinder(Ray *ray, Hit *hit, Object *cylinder);
+bool intersectDisk(Ray *ray, Hit *hit, Object *disk);
+bool intersectPlane(Ray *ray, Hit *hit, Object *plane);
+bool intersectSphere(Ray *ray, Hit *hit, Object *sphere);
+bool intersectTriangle(Ray *ray, Hit *hit, Object *triangle);
+bool intersectQuad(Ray *ray, Hit *hit, Object *quad);
+bool intersectMesh(Ray *ray, Hit *hit, Object *mesh);
+bool intersectHeightfield(Ray *ray, Hit *hit, Object *heightfield);
+//! ray / bilinear patch test, the closest t in ]ray->tmin, ray->tmax] and its (u,v) patch coordinates are returned
+bool intersectBilinearPatch(const Ray *ray, vec3 q00, vec3 q10, vec3 q11, vec3 q01, float *t, float *u, float *v);
+//! geometric normal of the bilinear patch at (u,v), not normalized
+vec3 bilinearPatchNormal(vec3 q00, vec3 q10, vec3 q11, vec3 q01, float u, float v);
 
 void renderImage(Image *img, Scene *scene);
 
@@ -1,13 +1,17 @@
 #include "scene.h"
 #include "scene_types.h"
+#include "assets.h"
+#include "texture.h"
 #include <string.h>
-#include <fstream>
+#include <stdio.h>
 #include <iostream>
-#include <algorithm>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/rotate_vector.hpp>
 
 
+//! size of the blocks the scene arena gets objects and lights from
+static const size_t scene_arena_chunk = 1 << 20;
+
 /* UTILS */
 std::vector<std::string> split(const std::string& str, const std::string& delim)
 {
@@ -25,38 +29,131 @@ std::vector<std::string> split(const std::string& str, const std::string& delim)
     return tokens;
 }
 
-Object *initSphere(point3 center, float radius, Material mat) {
-    Object *ret;
-    ret = (Object *)malloc(sizeof(Object));
+/* OBJECTS */
+//! objects keep a copy of their material, the textures it uses start being read (see queueTexture)
+static void setMaterial(Object *obj, const Material &mat) {
+    memcpy(&(obj->mat), &mat, sizeof(Material));
+    if (mat.hasImgTexture && mat.image_texture) queueTexture(mat.image_texture);
+    if (mat.hasBumpTexture && mat.bump_texture) queueTexture(mat.bump_texture);
+    if (mat.hasSpecTexture && mat.spec_texture) queueTexture(mat.spec_texture);
+    if (mat.hasRoughTexture && mat.rough_texture) queueTexture(mat.rough_texture);
+}
+
+//! objects added to a scene live in its arena, see addObject
+static Object *newObject(Scene *scene) {
+    Object *ret = (Object *)arenaAlloc(scene->arena, sizeof(Object));
+    scene->objects.push_back(ret);
+    return ret;
+}
+
+static Object *fillSphere(Object *ret, point3 center, float radius, Material mat) {
     ret->geom.type = SPHERE;
     ret->geom.sphere.center = center;
     ret->geom.sphere.radius = radius;
     ret->geom.sphere.dir = vec3(0.f,0.f,-1.f);
-    memcpy(&(ret->mat), &mat, sizeof(Material));
+    setMaterial(ret, mat);
     return ret;
 }
 
-Object *initPlane(vec3 normal, float d, Material mat) {
-    Object *ret;
-    ret = (Object *)malloc(sizeof(Object));
+static Object *fillPlane(Object *ret, vec3 normal, float d, Material mat) {
     ret->geom.type = PLANE;
     ret->geom.plane.normal = normalize(normal);
     ret->geom.plane.dist = d;
-    memcpy(&(ret->mat), &mat, sizeof(Material));
+    setMaterial(ret, mat);
     return ret;
 }
 
-Object *initTriangle(vec3 v0, vec3 v1, vec3 v2, Material mat){
-    Object *ret;
-    ret = (Object *)malloc(sizeof(Object));
+static Object *fillTriangle(Object *ret, vec3 v0, vec3 v1, vec3 v2, Material mat) {
     ret->geom.type = TRIANGLE;
     ret->geom.triangle.v0 = v0;
     ret->geom.triangle.v1 = v1;
     ret->geom.triangle.v2 = v2;
-    memcpy(&(ret->mat), &mat, sizeof(Material));
+    setMaterial(ret, mat);
+    return ret;
+}
+
+static Object *fillQuad(Object *ret, vec3 v00, vec3 v10, vec3 v11, vec3 v01, Material mat) {
+    ret->geom.type = QUAD;
+    ret->geom.quad.v00 = v00;
+    ret->geom.quad.v10 = v10;
+    ret->geom.quad.v11 = v11;
+    ret->geom.quad.v01 = v01;
+    setMaterial(ret, mat);
+    return ret;
+}
+
+static Object *fillBox(Object *ret, point3 center, vec3 halfSize, mat3 orientation, Material mat) {
+    ret->geom.type = BOX;
+    ret->geom.box.center = center;
+    ret->geom.box.halfSize = halfSize;
+    ret->orientation = orientation;
+    ret->geom.box.aligned = orientation[0] == vec3(1.f,0.f,0.f) && orientation[1] == vec3(0.f,1.f,0.f) && orientation[2] == vec3(0.f,0.f,1.f);
+    setMaterial(ret, mat);
+    return ret;
+}
+
+static Object *fillCylinder(Object *ret, point3 base, vec3 axis, float radius, float height, Material mat) {
+    ret->geom.type = CYLINDER;
+    ret->geom.cylinder.base = base;
+    ret->geom.cylinder.axis = normalize(axis);
+    ret->geom.cylinder.radius = radius;
+    ret->geom.cylinder.height = height;
+    setMaterial(ret, mat);
     return ret;
 }
 
+static Object *fillDisk(Object *ret, point3 center, vec3 normal, float radius, Material mat) {
+    ret->geom.type = DISK;
+    ret->geom.disk.center = center;
+    ret->geom.disk.normal = normalize(normal);
+    ret->geom.disk.radius = radius;
+    setMaterial(ret, mat);
+    return ret;
+}
+
+Object *initSphere(point3 center, float radius, Material mat) {
+    return fillSphere((Object *)malloc(sizeof(Object)), center, radius, mat);
+}
+
+Object *initPlane(vec3 normal, float d, Material mat) {
+    return fillPlane((Object *)malloc(sizeof(Object)), normal, d, mat);
+}
+
+Object *initTriangle(vec3 v0, vec3 v1, vec3 v2, Material mat){
+    return fillTriangle((Object *)malloc(sizeof(Object)), v0, v1, v2, mat);
+}
+
+Object *initQuad(vec3 v00, vec3 v10, vec3 v11, vec3 v01, Material mat) {
+    return fillQuad((Object *)malloc(sizeof(Object)), v00, v10, v11, v01, mat);
+}
+
+void addQuad(Scene *scene, vec3 v00, vec3 v10, vec3 v11, vec3 v01, Material mat) {
+    fillQuad(newObject(scene), v00, v10, v11, v01, mat);
+}
+
+Object *initBox(point3 center, vec3 halfSize, Material mat) {
+    return fillBox((Object *)malloc(sizeof(Object)), center, halfSize, mat3(1.f), mat);
+}
+
+Object *initOrientedBox(point3 center, vec3 halfSize, vec3 xdir, vec3 ydir, Material mat) {
+    vec3 x = normalize(xdir);
+    vec3 z = normalize(cross(x, ydir));
+    vec3 y = cross(z, x);
+    return fillBox((Object *)malloc(sizeof(Object)), center, halfSize, mat3(x, y, z), mat);
+}
+
+Object *initCylinder(point3 base, vec3 axis, float radius, float height, Material mat) {
+    return fillCylinder((Object *)malloc(sizeof(Object)), base, axis, radius, height, mat);
+}
+
+Object *initDisk(point3 center, vec3 normal, float radius, Material mat) {
+    return fillDisk((Object *)malloc(sizeof(Object)), center, normal, radius, mat);
+}
+
+void addTriangle(Scene *scene, vec3 v0, vec3 v1, vec3 v2, Material mat){
+    fillTriangle(newObject(scene), v0, v1, v2, mat);
+}
+
 void initTriFace(Scene *s, vec3 normal, int res, Material mat, float scale, vec3 centerPos, bool sphere){
     if (res < 2)  res = 2;
     if (res > 256 )   res = 256;
@@ -82,19 +179,14 @@ void initTriFace(Scene *s, vec3 normal, int res, Material mat, float scale, vec3
             int i = x + y * res;
 
             if (x != res - 1 && y != res - 1) {
-                addObject(s, initTriangle(points[i],points[i+res+1],points[i+res], mat));
-                addObject(s, initTriangle(points[i],points[i+1],points[i+res+1], mat));
+                addQuad(s, points[i],points[i+1],points[i+res+1],points[i+res], mat);
             }
         }
     }
 }
 
-void initCube(Scene *s, int res, Material mat, float scale, vec3 centerPos){
-    vec3 up = vec3(0,1,0), side = vec3(1,0,0), depth = vec3(0,0,1);
-    vec3 n[6] = {up,-up,side,-side,depth,-depth};
-    for (int i = 0 ; i < 6 ; ++i){
-        initTriFace(s,n[i],res,mat,scale,centerPos,false);
-    }
+void initCube(Scene *s, Material mat, float scale, vec3 centerPos){
+    fillBox(newObject(s), centerPos, vec3(scale), mat3(1.f), mat);
 }
 
 void initSphere(Scene *s, int res, Material mat, float scale, vec3 centerPos){
@@ -107,39 +199,132 @@ void initSphere(Scene *s, int res, Material mat, float scale, vec3 centerPos){
 
 void initComplex(Scene *scene, const std::string &filename, Material mat, float scale, vec3 pos, float angle){
 
-    std::string line;
-    std::ifstream objFile(filename);
-    if (objFile.is_open()){
-        std::vector<vec3> vertexes;
-        vertexes.emplace_back(vec3(0.f));
-        while (getline(objFile, line)){
-            std::vector<std::string> splittedLine = split(line, " ");
-            std::string specifier;
-            if (splittedLine.empty()){
-                specifier = " ";
-            }else{
-                specifier = splittedLine[0];
-            }
-            if (specifier == "v"){
-                //the line defines a vertex
-                float x = std::stof(splittedLine[1]);
-                float y = std::stof(splittedLine[2]);
-                float z = std::stof(splittedLine[3]);
-                vertexes.emplace_back(pos+(rotate(vec3(x,y,z)*scale, angle, vec3(0.f,1.f,0.f))));
-            }else if (specifier == "f"){
-                //the line defines a triangle
-                std::vector<std::string> strA = split(splittedLine[1], "/");
-                vec3 a = vertexes[size_t(std::stoi(strA[0]))];
-                std::vector<std::string> strB = split(splittedLine[2], "/");
-                vec3 b = vertexes[size_t(std::stoi(strB[0]))];
-                std::vector<std::string> strC = split(splittedLine[3], "/");
-                vec3 c = vertexes[size_t(std::stoi(strC[0]))];
-                addObject(scene, initTriangle(b, a, c, mat));
-            }
+    Mesh *mesh = acquireMesh(filename.c_str());
+    if (mesh == NULL) return;
+    scene->meshes.push_back(mesh);
+
+    vec3 up(0.f,1.f,0.f);
+    mat3 orientation(rotate(vec3(scale,0.f,0.f), angle, up),
+                     rotate(vec3(0.f,scale,0.f), angle, up),
+                     rotate(vec3(0.f,0.f,scale), angle, up));
+    Object *obj = newObject(scene);
+    obj->geom.type = MESH;
+    obj->geom.mesh.mesh = mesh;
+    obj->geom.mesh.lod = 0;
+    obj->geom.mesh.toLocal = inverse(orientation);
+    obj->orientation = orientation;
+    obj->tranlation = pos;
+    setMaterial(obj, mat);
+}
+
+void initHeightfield(Scene *scene, Image *heights, vec3 origin, vec3 size, Material mat) {
+    if (heights == NULL || heights->width < 2 || heights->height < 2) {
+        fprintf(stderr, "Heightfield : needs an image of at least 2x2 pixels\n");
+        return;
+    }
+    Object *obj = newObject(scene);
+    obj->geom.type = HEIGHTFIELD;
+    obj->geom.heightfield.data = initHeightfieldData(scene->arena, heights);
+    obj->geom.heightfield.origin = origin;
+    obj->geom.heightfield.size = size;
+    setMaterial(obj, mat);
+}
+
+Texture *sceneTexture(Scene *scene, const char *filename, TextureCompression compression) {
+    Texture *texture = initTexture(filename, compression);
+    scene->textures.push_back(texture);
+    return texture;
+}
+
+void selectMeshLods(Scene *scene, size_t width) {
+    const Camera &cam = scene->cam;
+    //distance from the eye to the image plane, which spans [-1,1] horizontally
+    float focal = length(cam.center);
+    for (Object *obj : scene->objects) {
+        if (obj->geom.type != MESH) continue;
+        Mesh *mesh = obj->geom.mesh.mesh;
+        vec3 bmin, bmax;
+        objectBounds(obj, &bmin, &bmax);
+        vec3 center = 0.5f * (bmin + bmax);
+        float radius = 0.5f * length(bmax - bmin);
+        float dist = dot(center - cam.position, cam.zdir);
+        if (dist <= radius) {
+            //the camera is close to or inside the instance
+            obj->geom.mesh.lod = 0;
+            continue;
         }
+        float projectedRadius = radius / dist * focal * float(width) * 0.5f;
+        obj->geom.mesh.lod = selectMeshLod(mesh, projectedRadius);
     }
+}
 
-    objFile.close();
+//extent of a disk of normal n and radius r along each axis
+static vec3 diskExtent(vec3 n, float r) {
+    return r * vec3(sqrtf(fmaxf(0.f, 1.f - n.x*n.x)),
+                    sqrtf(fmaxf(0.f, 1.f - n.y*n.y)),
+                    sqrtf(fmaxf(0.f, 1.f - n.z*n.z)));
+}
+
+bool objectBounds(const Object *obj, vec3 *bmin, vec3 *bmax) {
+    switch (obj->geom.type) {
+        case SPHERE:
+            *bmin = obj->geom.sphere.center - obj->geom.sphere.radius;
+            *bmax = obj->geom.sphere.center + obj->geom.sphere.radius;
+            return true;
+        case TRIANGLE:
+            *bmin = min(obj->geom.triangle.v0, min(obj->geom.triangle.v1, obj->geom.triangle.v2));
+            *bmax = max(obj->geom.triangle.v0, max(obj->geom.triangle.v1, obj->geom.triangle.v2));
+            return true;
+        case QUAD:
+            *bmin = min(min(obj->geom.quad.v00, obj->geom.quad.v10), min(obj->geom.quad.v11, obj->geom.quad.v01));
+            *bmax = max(max(obj->geom.quad.v00, obj->geom.quad.v10), max(obj->geom.quad.v11, obj->geom.quad.v01));
+            return true;
+        case BOX: {
+            const mat3 &o = obj->orientation;
+            vec3 h = obj->geom.box.halfSize;
+            vec3 e = abs(o[0]) * h.x + abs(o[1]) * h.y + abs(o[2]) * h.z;
+            *bmin = obj->geom.box.center - e;
+            *bmax = obj->geom.box.center + e;
+            return true;
+        }
+        case CYLINDER: {
+            vec3 a = obj->geom.cylinder.base;
+            vec3 b = a + obj->geom.cylinder.height * obj->geom.cylinder.axis;
+            vec3 e = diskExtent(obj->geom.cylinder.axis, obj->geom.cylinder.radius);
+            *bmin = min(a, b) - e;
+            *bmax = max(a, b) + e;
+            return true;
+        }
+        case MESH: {
+            //transformed corners of the model space box
+            const Mesh *mesh = obj->geom.mesh.mesh;
+            for (int i = 0 ; i < 8 ; ++i) {
+                vec3 corner((i & 1) ? mesh->bmax.x : mesh->bmin.x,
+                            (i & 2) ? mesh->bmax.y : mesh->bmin.y,
+                            (i & 4) ? mesh->bmax.z : mesh->bmin.z);
+                vec3 p = obj->tranlation + obj->orientation * corner;
+                *bmin = i ? min(*bmin, p) : p;
+                *bmax = i ? max(*bmax, p) : p;
+            }
+            return true;
+        }
+        case HEIGHTFIELD: {
+            const Heightfield *hf = obj->geom.heightfield.data;
+            vec2 range = heightfieldNode(hf, hf->levelCount - 1, 0, 0);
+            vec3 origin = obj->geom.heightfield.origin, size = obj->geom.heightfield.size;
+            *bmin = origin + vec3(0.f, range.x * size.y, 0.f);
+            *bmax = origin + vec3(size.x, range.y * size.y, size.z);
+            return true;
+        }
+        case DISK: {
+            vec3 e = diskExtent(obj->geom.disk.normal, obj->geom.disk.radius);
+            *bmin = obj->geom.disk.center - e;
+            *bmax = obj->geom.disk.center + e;
+            return true;
+        }
+        default:
+            return false;
+    }
 }
 
 void freeObject(Object *obj) {
@@ -158,12 +343,18 @@ void freeLight(Light *light) {
 }
 
 Scene * initScene() {
-    return new Scene;
+    Scene *scene = new Scene;
+    scene->arena = initArena(scene_arena_chunk);
+    return scene;
 }
 
 void freeScene(Scene *scene) {
-    std::for_each(scene->objects.begin(), scene->objects.end(), freeObject);
-    std::for_each(scene->lights.begin(), scene->lights.end(), freeLight);
+    //objects and lights all live in the arena
+    freeArena(scene->arena);
+    for (Mesh *mesh : scene->meshes)
+        releaseMesh(mesh);
+    for (Texture *texture : scene->textures)
+        freeTexture(texture);
     delete scene;
 }
 
@@ -178,11 +369,15 @@ void setCamera(Scene *scene, point3 position, point3 at, vec3 up, float fov, flo
 }
 
 void addObject(Scene *scene, Object *obj) {
-    scene->objects.push_back(obj);
+    memcpy(newObject(scene), obj, sizeof(Object));
+    freeObject(obj);
 }
 
 void addLight(Scene *scene, Light *light) {
-    scene->lights.push_back(light);
+    Light *ret = (Light *)arenaAlloc(scene->arena, sizeof(Light));
+    memcpy(ret, light, sizeof(Light));
+    freeLight(light);
+    scene->lights.push_back(ret);
 }
 
 void setSkyColor(Scene *scene, color3 c) {
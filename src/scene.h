@@ -3,6 +3,7 @@
 
 #include "defines.h"
 #include "image.h"
+#include "texture.h"
 #include <string>
 #include <vector>
 
@@ -18,17 +19,17 @@ typedef struct material_s {
 	color3 specularColor;	//! Specular "albedo"
 	color3 diffuseColor;	//! Base color
 	float transparency;     //! 0 : not transparent, 1 : totally transparent
-	Image *image_texture;   //! Texture that replace diffuse color
-	Image *bump_texture;    //! Texture that change normals direction
-	Image *spec_texture;    //! Texture that replace specular color
-	Image *rough_texture;   //! Texture that set roughness
+	Texture *image_texture;   //! Texture that replace diffuse color
+	Texture *bump_texture;    //! Texture that change normals direction, best read as TEXTURE_UNIT_NORMALS or TEXTURE_NORMAL_BLOCKS
+	Texture *spec_texture;    //! Texture that replace specular color
+	Texture *rough_texture;   //! Texture that set roughness, read as TEXTURE_ROUGHNESS
 	bool hasImgTexture;
     bool hasBumpTexture;
 	bool hasSpecTexture;
 	bool hasRoughTexture;
 } Material;
 
-enum Etype {SPHERE=1, PLANE, TRIANGLE};
+enum Etype {SPHERE=1, PLANE, TRIANGLE, BOX, CYLINDER, DISK, QUAD, MESH, HEIGHTFIELD};
 
 std::vector<std::string> split(const std::string& str, const std::string& delim);
 
@@ -36,11 +37,43 @@ std::vector<std::string> split(const std::string& str, const std::string& delim)
 Object* initSphere(point3 center, float radius, Material mat);
 Object* initPlane(vec3 normal, float d, Material mat);
 Object* initTriangle(vec3 v0, vec3 v1, vec3 v2, Material mat);
+//! create a triangle directly in the scene storage (no temporary object), for meshes
+void addTriangle(Scene *scene, vec3 v0, vec3 v1, vec3 v2, Material mat);
+//! bilinear patch through v00, v10, v11, v01 (in order around the patch)
+Object* initQuad(vec3 v00, vec3 v10, vec3 v11, vec3 v01, Material mat);
+//! create a quad directly in the scene storage (no temporary object), for meshes
+void addQuad(Scene *scene, vec3 v00, vec3 v10, vec3 v11, vec3 v01, Material mat);
+//! axis aligned box
+Object* initBox(point3 center, vec3 halfSize, Material mat);
+//! box whose local x and y axes are xdir and ydir (z is their cross product)
+Object* initOrientedBox(point3 center, vec3 halfSize, vec3 xdir, vec3 ydir, Material mat);
+//! capped cylinder from base to base + height * axis
+Object* initCylinder(point3 base, vec3 axis, float radius, float height, Material mat);
+Object* initDisk(point3 center, vec3 normal, float radius, Material mat);
 void initTriFace(Scene *s, vec3 normal, int res, Material mat, bool sphere, float scale, vec3 centerPos);
-void initCube(Scene *s, int res, Material mat, float scale, vec3 centerPos);
+//! cube of side 2*scale, a single box primitive
+void initCube(Scene *s, Material mat, float scale, vec3 centerPos);
 void initSphere(Scene *s, int res, Material mat, float scale, vec3 centerPos);
+//! terrain whose heights are read from the image (mean of the channels, in [0,1]), spanning size.x
+//! along x and size.z along z from origin, with heights from origin.y to origin.y + size.y.
+//! the image is not copied and must outlive the scene
+void initHeightfield(Scene *scene, Image *heights, vec3 origin, vec3 size, Material mat);
+
+//! load an OBJ or binary PLY file as a mesh (with its levels of detail, see loadMesh for its cache) and
+//! add one instance of it, scaled, rotated of angle around the y axis then moved to pos
 void initComplex(Scene *scene, const std::string &filename, Material mat, float scale, vec3 pos, float angle);
 
+//! texture of filename, read when first sampled (see textureLevels) and released with the scene.
+//! bump maps are best read as TEXTURE_UNIT_NORMALS or TEXTURE_NORMAL_BLOCKS, as colors they are decoded when shaded
+Texture *sceneTexture(Scene *scene, const char *filename, TextureCompression compression = TEXTURE_UNCOMPRESSED);
+
+//! pick the level of detail of every mesh instance from its size on screen, for the scene camera
+//! and an image width pixels wide
+void selectMeshLods(Scene *scene, size_t width);
+
+//! world space bounding box of obj, returns false for unbounded objects (planes)
+bool objectBounds(const Object *obj, vec3 *bmin, vec3 *bmax);
+
 //! release memory for the object obj
 void freeObject(Object *obj);
 
@@ -56,10 +89,10 @@ void freeScene(Scene *scene);
 
 void setCamera(Scene *scene, point3 position, vec3 at, vec3 up, float fov, float aspect);
 
-//! take ownership of obj freeScene will free obj) ... typically use addObject(scene, initPlane()
+//! take ownership of obj : it is moved to the scene arena and obj is released ... typically use addObject(scene, initPlane()
 void addObject(Scene *scene, Object *obj);
 
-//! take ownership of light : freeScene will free light) ... typically use addObject(scene, initLight()
+//! take ownership of light : it is moved to the scene arena and light is released ... typically use addObject(scene, initLight()
 void addLight(Scene *scene, Light *light);
 
 void setSkyColor(Scene *scene, color3 c);
@@ -3,6 +3,10 @@
 
 #include "defines.h"
 #include "scene.h"
+#include "arena.h"
+#include "mesh.h"
+#include "heightfield.h"
+#include "texture.h"
 #include <vector>
 
 //! \file : internal types to describe a scene
@@ -41,17 +45,51 @@ typedef struct geometry_s {
             //Triangle
             vec3 v0,v1,v2;
         } triangle;
+        struct {
+            //Bilinear patch (quad), v00 v10 v11 v01 in order around the patch
+            vec3 v00,v10,v11,v01;
+        } quad;
+        struct {
+            //Box, axes given by the object orientation
+            vec3 center;
+            vec3 halfSize; //! half extent along each local axis
+            bool aligned; //! orientation is the identity, the ray is not transformed
+        } box;
+        struct {
+            //Capped cylinder
+            vec3 base; //! center of the bottom cap
+            vec3 axis; //! normalized, from bottom to top cap
+            float radius;
+            float height;
+        } cylinder;
+        struct {
+            //Instance of a mesh : orientation (rotation and scale) and translation place it in the scene
+            Mesh *mesh;
+            int lod; //! level of detail used for the current camera, see selectMeshLods
+            mat3 toLocal; //! inverse of orientation, brings rays in model space
+        } mesh;
+        struct {
+            //Heightfield : its samples span [origin, origin + size], heights going up along y
+            Heightfield *data;
+            vec3 origin;
+            vec3 size;
+        } heightfield;
+        struct {
+            //Disk
+            vec3 center;
+            vec3 normal;
+            float radius;
+        } disk;
     };
 } Geometry;
 
 typedef struct object_s {
-  /** not used yet, but you should use it to transform ray before
-   *  computing intersection (and thu have a better control on 3D position
+  /** local axes of the object (as columns), boxes and meshes use it to transform the ray
+   *  in their frame before computing intersection
    */
   mat3 orientation; 
   
-  /** not used yet, but you should use it to transform ray before
-   *  computing intersection (and thu have a better control on 3D position
+  /** position of the model space origin, used by meshes
    */
   vec3 tranlation; 
   
@@ -61,12 +99,17 @@ typedef struct object_s {
 
 typedef std::vector<Object*> Objects;
 typedef std::vector<Light*> Lights;
+typedef std::vector<Mesh*> Meshes;
+typedef std::vector<Texture*> Textures;
 
 typedef struct scene_s {
   Lights lights; //! the scene have several lights
   Objects objects; //! the scene have severapoint3(obj->geom.sphere.center.x, obj->geom.sphere.center)point3(obj->geom.sphere.center.x, obj->geom.sphere.center)l objects
   Camera cam; //! the scene have one camera
   color3 skyColor; //! the sky color, could be extended to a sky function ;)
+  Arena *arena; //! storage of every object and light of the scene, released at once by freeScene
+  Meshes meshes; //! meshes instanced by the MESH objects, the scene holds one reference to each (see assets.h)
+  Textures textures; //! textures of the materials of the scene, freed with it
 } Scene;
 
 #endif
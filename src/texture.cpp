@@ -0,0 +1,717 @@
+#include "texture.h"
+#include "assets.h"
+#include "pagecache.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <omp.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <thread>
+
+#define UNORM8_4(i) float(i)/255.f, float(i+1)/255.f, float(i+2)/255.f, float(i+3)/255.f
+#define UNORM8_16(i) UNORM8_4(i), UNORM8_4(i+4), UNORM8_4(i+8), UNORM8_4(i+12)
+#define UNORM8_64(i) UNORM8_16(i), UNORM8_16(i+16), UNORM8_16(i+32), UNORM8_16(i+48)
+const float texel_unorm8[256] = { UNORM8_64(0), UNORM8_64(64), UNORM8_64(128), UNORM8_64(192) };
+
+uint16_t floatToHalf(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(f));
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    bits &= 0x7fffffffu;
+    //2^16 and above, infinity or NaN (what rounds up to 2^16 becomes infinity below)
+    if (bits >= 0x47800000u)
+        return uint16_t(sign | (bits > 0x7f800000u ? 0x7e00u : 0x7c00u));
+    //below the smallest normal half : adding 0.5 puts the denormal mantissa in the low bits, rounded
+    if (bits < 0x38800000u) {
+        float denormal;
+        memcpy(&denormal, &bits, sizeof(f));
+        denormal += 0.5f;
+        memcpy(&bits, &denormal, sizeof(f));
+        return uint16_t(sign | (bits - 0x3f000000u));
+    }
+    //rebias the exponent from 127 to 15, rounding the 13 dropped bits to nearest even
+    bits += 0xc8000fffu + ((bits >> 13) & 1u);
+    return uint16_t(sign | (bits >> 13));
+}
+
+static size_t pageBytes(TexelFormat format) {
+    return tileBytes(format) << (2 * texture_page_log);
+}
+
+static size_t levelPages(const TextureLevel &level) {
+    size_t tilesY = (level.height + texture_tile - 1) >> texture_tile_log;
+    return level.pagesX * ((tilesY + texture_page - 1) >> texture_page_log);
+}
+
+static size_t levelSize(const TextureLevel &level) {
+    return levelPages(level) * pageBytes(level.format);
+}
+
+//! level without texels
+static TextureLevel emptyLevel(size_t width, size_t height, TexelFormat format) {
+    TextureLevel level;
+    level.width = width;
+    level.height = height;
+    level.format = format;
+    level.tilesX = (width + texture_tile - 1) >> texture_tile_log;
+    level.pagesX = (level.tilesX + texture_page - 1) >> texture_page_log;
+    level.texels = NULL;
+    level.file = -1;
+    level.offset = level.firstPage = 0;
+    return level;
+}
+
+static TextureLevel initLevel(size_t width, size_t height, TexelFormat format) {
+    TextureLevel level = emptyLevel(width, height, format);
+    level.texels = (unsigned char *)calloc(levelPages(level), pageBytes(format));
+    return level;
+}
+
+static inline uint16_t unorm16(float c) {
+    return uint16_t(glm::clamp(c, 0.f, 1.f) * 65535.f + 0.5f);
+}
+
+//! texel i (see texelIndex) of a level in TEXEL_RGB8 or TEXEL_RGB16F
+static inline color3 plainTexel(const TextureLevel &level, size_t i) {
+    if (level.format == TEXEL_RGB8) {
+        const unsigned char *p = level.texels + 4 * i;
+        return color3(texel_unorm8[p[0]], texel_unorm8[p[1]], texel_unorm8[p[2]]);
+    }
+    const uint16_t *p = (const uint16_t *)level.texels + 4 * i;
+    return color3(halfToFloat(p[0]), halfToFloat(p[1]), halfToFloat(p[2]));
+}
+
+//! store c as texel i, as a vector for TEXEL_OCT16 (normalized), its first channel for TEXEL_R16F
+static inline void storeTexelAt(TextureLevel &level, size_t i, color3 c) {
+    if (level.format == TEXEL_RGB8) {
+        unsigned char *p = level.texels + 4 * i;
+        for (int k = 0; k < 3; ++k)
+            p[k] = (unsigned char)(glm::clamp(c[k], 0.f, 1.f) * 255.f + 0.5f);
+    } else if (level.format == TEXEL_RGB16F) {
+        uint16_t *p = (uint16_t *)level.texels + 4 * i;
+        for (int k = 0; k < 3; ++k)
+            p[k] = floatToHalf(c[k]);
+    } else if (level.format == TEXEL_OCT16) {
+        //on the octahedron |x| + |y| + |z| = 1, the lower half folded over the upper one
+        float sum = fabsf(c.x) + fabsf(c.y) + fabsf(c.z), scale = sum > 0.f ? 1.f / sum : 0.f;
+        float ox = c.x * scale, oy = c.y * scale;
+        if (c.z < 0.f) {
+            float fx = (1.f - fabsf(oy)) * (ox < 0.f ? -1.f : 1.f);
+            oy = (1.f - fabsf(ox)) * (oy < 0.f ? -1.f : 1.f);
+            ox = fx;
+        }
+        uint16_t *p = (uint16_t *)level.texels + 2 * i;
+        p[0] = unorm16(0.5f * ox + 0.5f);
+        p[1] = unorm16(0.5f * oy + 0.5f);
+    } else {
+        ((uint16_t *)level.texels)[i] = floatToHalf(c.x);
+    }
+}
+
+static inline void storeTexel(TextureLevel &level, size_t x, size_t y, color3 c) {
+    storeTexelAt(level, texelIndex(level, x, y), c);
+}
+
+//! box filter of level to half its size (rounded down, at least 1), the last row or column of an odd size is shared
+static TextureLevel halveLevel(const TextureLevel &level) {
+    TextureLevel half = initLevel(level.width > 1 ? level.width / 2 : 1, level.height > 1 ? level.height / 2 : 1, level.format);
+    #pragma omp parallel for if (half.width * half.height > 4096)
+    for (size_t y = 0; y < half.height; ++y) {
+        size_t y0 = std::min(2*y, level.height - 1), y1 = std::min(2*y + 1, level.height - 1);
+        for (size_t x = 0; x < half.width; ++x) {
+            size_t x0 = std::min(2*x, level.width - 1), x1 = std::min(2*x + 1, level.width - 1);
+            if (level.format == TEXEL_RGB8) {
+                //exact on the bytes, rounded
+                const unsigned char *p00 = level.texels + 4 * texelIndex(level, x0, y0), *p10 = level.texels + 4 * texelIndex(level, x1, y0);
+                const unsigned char *p01 = level.texels + 4 * texelIndex(level, x0, y1), *p11 = level.texels + 4 * texelIndex(level, x1, y1);
+                unsigned char *p = half.texels + 4 * texelIndex(half, x, y);
+                for (int k = 0; k < 3; ++k)
+                    p[k] = (unsigned char)((p00[k] + p10[k] + p01[k] + p11[k] + 2) >> 2);
+            } else {
+                storeTexel(half, x, y, 0.25f * (texelAt(level, x0, y0) + texelAt(level, x1, y0)
+                                                + texelAt(level, x0, y1) + texelAt(level, x1, y1)));
+            }
+        }
+    }
+    return half;
+}
+
+//! tiled level of width x height texels, store(level, x, y) writing each one
+template<class Store>
+static TextureLevel tileLevel(size_t width, size_t height, TexelFormat format, const Store &store) {
+    TextureLevel level = initLevel(width, height, format);
+    size_t tilesY = (height + texture_tile - 1) >> texture_tile_log;
+    //tile after tile, the texels are written in order
+    #pragma omp parallel for
+    for (size_t ty = 0; ty < tilesY; ++ty) {
+        size_t y1 = std::min((ty + 1) << texture_tile_log, height);
+        for (size_t tx = 0; tx < level.tilesX; ++tx) {
+            size_t x0 = tx << texture_tile_log, x1 = std::min(x0 + texture_tile, width);
+            for (size_t y = ty << texture_tile_log; y < y1; ++y)
+                for (size_t x = x0; x < x1; ++x)
+                    store(level, x, y);
+        }
+    }
+    return level;
+}
+
+static MipChain *buildMipChain(const TextureLevel &first) {
+    MipChain *mipChain = new MipChain;
+    mipChain->file = -1;
+    mipChain->levels.push_back(first);
+    while (mipChain->levels.back().width > 1 || mipChain->levels.back().height > 1)
+        mipChain->levels.push_back(halveLevel(mipChain->levels.back()));
+    return mipChain;
+}
+
+MipChain *initMipChain(const Image *img) {
+    return buildMipChain(tileLevel(img->width, img->height, TEXEL_RGB16F, [img](TextureLevel &level, size_t x, size_t y) {
+        storeTexel(level, x, y, img->data[y * img->width + x]);
+    }));
+}
+
+MipChain *initMipChainBytes(const unsigned char *rgb, size_t width, size_t height) {
+    return buildMipChain(tileLevel(width, height, TEXEL_RGB8, [rgb, width](TextureLevel &level, size_t x, size_t y) {
+        memcpy(level.texels + 4 * texelIndex(level, x, y), rgb + 3 * (y * width + x), 3);
+    }));
+}
+
+//! the texels of tile (tx, ty) of level row after row, in [0,255], those outside the level repeat its last row or column
+static void readTile(const TextureLevel &level, size_t tx, size_t ty, color3 texels[16]) {
+    for (size_t i = 0; i < 16; ++i) {
+        size_t x = std::min((tx << texture_tile_log) + (i & 3), level.width - 1);
+        size_t y = std::min((ty << texture_tile_log) + (i >> 2), level.height - 1);
+        texels[i] = 255.f * texelAt(level, x, y);
+    }
+}
+
+static unsigned quantizeChannel(float c, unsigned max) {
+    return unsigned(std::min(std::max(c * float(max) / 255.f + 0.5f, 0.f), float(max)));
+}
+
+static unsigned bc1Quantize(color3 c) {
+    return quantizeChannel(c.r, 31) << 11 | quantizeChannel(c.g, 63) << 5 | quantizeChannel(c.b, 31);
+}
+
+//! the two colors are the ends of the texels along their principal axis, each texel takes the closest of the 4
+static void encodeBC1(const color3 texels[16], unsigned char *block) {
+    color3 mean(0.f);
+    for (size_t i = 0; i < 16; ++i) mean += texels[i];
+    mean *= 1.f/16.f;
+    mat3 covariance(0.f);
+    for (size_t i = 0; i < 16; ++i) {
+        vec3 d = texels[i] - mean;
+        for (int k = 0; k < 3; ++k)
+            covariance[k] += d[k] * d;
+    }
+    //power iterations, from the column of the largest variance (a fixed start can be orthogonal to the axis)
+    int largest = covariance[1][1] > covariance[0][0] ? 1 : 0;
+    if (covariance[2][2] > covariance[largest][largest]) largest = 2;
+    vec3 axis = covariance[largest];
+    for (int k = 0; k < 8; ++k) {
+        axis = covariance * axis;
+        float length2 = dot(axis, axis);
+        if (length2 < 1e-12f) { axis = vec3(0.f); break; }
+        axis *= 1.f / sqrtf(length2);
+    }
+    float lo = 0.f, hi = 0.f;
+    for (size_t i = 0; i < 16; ++i) {
+        float t = dot(texels[i] - mean, axis);
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+    }
+    unsigned c0 = bc1Quantize(mean + hi * axis), c1 = bc1Quantize(mean + lo * axis);
+    //c0 > c1 is the 4 color mode
+    if (c0 < c1) std::swap(c0, c1);
+    block[0] = c0 & 255; block[1] = c0 >> 8;
+    block[2] = c1 & 255; block[3] = c1 >> 8;
+    block[4] = block[5] = block[6] = block[7] = 0;
+    if (c0 == c1) return;
+
+    color3 palette[4] = {bc1Color(c0), bc1Color(c1), color3(0.f), color3(0.f)};
+    palette[2] = (2.f * palette[0] + palette[1]) * (1.f/3.f);
+    palette[3] = (palette[0] + 2.f * palette[1]) * (1.f/3.f);
+    for (size_t i = 0; i < 16; ++i) {
+        color3 c = texels[i] * (1.f/255.f);
+        unsigned best = 0;
+        float bestDistance = dot(c - palette[0], c - palette[0]);
+        for (unsigned k = 1; k < 4; ++k) {
+            float distance = dot(c - palette[k], c - palette[k]);
+            if (distance < bestDistance) { best = k; bestDistance = distance; }
+        }
+        block[4 + (i >> 2)] |= best << (2 * (i & 3));
+    }
+}
+
+//! one channel : its minimum and maximum, each value takes the closest of the 8 between them
+static void encodeBC4(const float values[16], unsigned char *block) {
+    float lo = values[0], hi = values[0];
+    for (size_t i = 1; i < 16; ++i) {
+        lo = std::min(lo, values[i]);
+        hi = std::max(hi, values[i]);
+    }
+    unsigned e0 = unsigned(hi + 0.5f), e1 = unsigned(lo + 0.5f);
+    block[0] = (unsigned char)e0;
+    block[1] = (unsigned char)e1;
+    uint64_t bits = 0;
+    if (e0 > e1) {
+        float scale = 7.f / float(e0 - e1);
+        for (size_t i = 0; i < 16; ++i) {
+            //step from e1 (0) to e0 (7), the indices run e0, e1, then from e0 to e1
+            int step = std::min(std::max(int((values[i] - float(e1)) * scale + 0.5f), 0), 7);
+            uint64_t index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+            bits |= index << (3 * i);
+        }
+    }
+    for (size_t k = 0; k < 6; ++k)
+        block[2 + k] = (unsigned char)(bits >> (8 * k));
+}
+
+static void encodeBC5(const color3 texels[16], unsigned char *block) {
+    float red[16], green[16];
+    for (size_t i = 0; i < 16; ++i) {
+        red[i] = texels[i].r;
+        green[i] = texels[i].g;
+    }
+    encodeBC4(red, block);
+    encodeBC4(green, block + 8);
+}
+
+vec3 unitNormal(color3 c) {
+    vec3 n(c.r - 0.5f, c.g - 0.5f, c.b);
+    float length2 = dot(n, n);
+    return length2 > 0.f ? n * (1.f / sqrtf(length2)) : vec3(0.f, 0.f, 1.f);
+}
+
+float roughnessAlpha(color3 c) {
+    float mean = (c.r + c.g + c.b) * (1.f/3.f);
+    return mean > 0.f ? std::min(0.1f / mean, 0.7f) : 0.7f;
+}
+
+static TexelFormat compressedFormat(TextureCompression compression) {
+    switch (compression) {
+        case TEXTURE_COLOR_BLOCKS: return TEXEL_BC1;
+        case TEXTURE_NORMAL_BLOCKS: return TEXEL_BC5;
+        case TEXTURE_UNIT_NORMALS: return TEXEL_OCT16;
+        default: return TEXEL_R16F;
+    }
+}
+
+//! each level from the texels of its own size, the filtered colors of the maps are turned into normals or
+//! roughness as the shading did with the colors it sampled
+void compressMipChain(MipChain *mipChain, TextureCompression compression) {
+    if (compression == TEXTURE_UNCOMPRESSED) return;
+    TexelFormat format = compressedFormat(compression);
+    for (TextureLevel &level : mipChain->levels) {
+        TextureLevel compressed = initLevel(level.width, level.height, format);
+        if (format == TEXEL_OCT16 || format == TEXEL_R16F) {
+            //same layout texel for texel, those of the tiles outside the level too
+            size_t texels = levelPages(level) << (2 * (texture_page_log + texture_tile_log));
+            #pragma omp parallel for if (texels > 4096)
+            for (size_t i = 0; i < texels; ++i) {
+                color3 c = plainTexel(level, i);
+                storeTexelAt(compressed, i, format == TEXEL_OCT16 ? unitNormal(c) : color3(roughnessAlpha(c)));
+            }
+        } else {
+            //rows of tiles on every core : each tile is read into its own texels and written to its own block,
+            //the encoders keep no other state
+            size_t tilesY = (level.height + texture_tile - 1) >> texture_tile_log, bytes = tileBytes(format);
+            #pragma omp parallel for if (level.width * level.height > 4096)
+            for (size_t ty = 0; ty < tilesY; ++ty) {
+                for (size_t tx = 0; tx < level.tilesX; ++tx) {
+                    color3 texels[16];
+                    readTile(level, tx, ty, texels);
+                    unsigned char *block = compressed.texels + tileIndex(compressed, tx, ty) * bytes;
+                    if (format == TEXEL_BC1) {
+                        encodeBC1(texels, block);
+                    } else {
+                        //x and y of the normals, in [0,255] as the colors
+                        for (size_t i = 0; i < 16; ++i)
+                            texels[i] = 127.5f * unitNormal(texels[i] / 255.f) + 127.5f;
+                        encodeBC5(texels, block);
+                    }
+                }
+            }
+        }
+        free(level.texels);
+        level = compressed;
+    }
+}
+
+size_t mipChainSize(const MipChain *mipChain) {
+    size_t size = 0;
+    for (const TextureLevel &level : mipChain->levels)
+        size += levelSize(level);
+    return size;
+}
+
+void freeMipChain(MipChain *mipChain) {
+    for (TextureLevel &level : mipChain->levels) {
+        free(level.texels);
+        if (level.file >= 0) dropTexturePages(level.firstPage, levelPages(level));
+    }
+    if (mipChain->file >= 0) close(mipChain->file);
+    delete mipChain;
+}
+
+/* TEXTURE CACHE */
+//! a cache is a header, one TextureCacheLevel per level, then the texels of the levels (as in memory, pages
+//! after pages), each one starting on texture_cache_align bytes. everything is in native byte order
+static const char texture_cache_magic[4] = {'M', 'R', 'T', 'T'};
+static const uint32_t texture_cache_version = 1;
+static const uint32_t texture_cache_byte_order = 0x01020304;
+static const size_t texture_cache_align = 4096;
+static const uint32_t texture_cache_max_levels = 64;
+
+typedef struct texture_cache_header_s {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t levelCount;
+} TextureCacheHeader;
+
+typedef struct texture_cache_level_s {
+    uint64_t width, height;
+    uint64_t format;
+    uint64_t offset; //! of the texels
+} TextureCacheLevel;
+
+bool writeMipChainCache(const char *filename, const MipChain *mipChain) {
+    TextureCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, texture_cache_magic, 4);
+    header.version = texture_cache_version;
+    header.byteOrder = texture_cache_byte_order;
+    header.levelCount = uint32_t(mipChain->levels.size());
+
+    std::vector<TextureCacheLevel> table(mipChain->levels.size());
+    uint64_t offset = sizeof(TextureCacheHeader) + table.size() * sizeof(TextureCacheLevel);
+    for (size_t i = 0; i < table.size(); ++i) {
+        const TextureLevel &level = mipChain->levels[i];
+        table[i].width = level.width;
+        table[i].height = level.height;
+        table[i].format = level.format;
+        table[i].offset = offset = (offset + texture_cache_align - 1) / texture_cache_align * texture_cache_align;
+        offset += levelSize(level);
+    }
+
+    //written aside then renamed, so that a concurrent run never reads a partial cache
+    std::string tmp = std::string(filename) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (f == NULL) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(table.data(), sizeof(TextureCacheLevel), table.size(), f) == table.size();
+    for (size_t i = 0; ok && i < table.size(); ++i) {
+        const TextureLevel &level = mipChain->levels[i];
+        ok = level.texels != NULL && fseek(f, long(table[i].offset), SEEK_SET) == 0
+             && fwrite(level.texels, 1, levelSize(level), f) == levelSize(level);
+    }
+    ok = fclose(f) == 0 && ok;
+    if (ok) ok = rename(tmp.c_str(), filename) == 0;
+    if (!ok) remove(tmp.c_str());
+    return ok;
+}
+
+MipChain *loadMipChainCache(const char *filename) {
+    int file = open(filename, O_RDONLY);
+    if (file < 0) {
+        fprintf(stderr, "Cannot open file %s...\n", filename);
+        return NULL;
+    }
+    struct stat info;
+    TextureCacheHeader header;
+    bool ok = fstat(file, &info) == 0 && pread(file, &header, sizeof(header), 0) == ssize_t(sizeof(header))
+              && memcmp(header.magic, texture_cache_magic, 4) == 0 && header.version == texture_cache_version
+              && header.byteOrder == texture_cache_byte_order && header.levelCount > 0 && header.levelCount <= texture_cache_max_levels;
+    std::vector<TextureCacheLevel> table(ok ? header.levelCount : 0);
+    size_t tableSize = table.size() * sizeof(TextureCacheLevel);
+    ok = ok && pread(file, table.data(), tableSize, sizeof(header)) == ssize_t(tableSize);
+
+    MipChain *mipChain = new MipChain;
+    mipChain->file = file;
+    for (size_t i = 0; ok && i < table.size(); ++i) {
+        const TextureCacheLevel &entry = table[i];
+        ok = entry.format <= TEXEL_R16F && entry.width > 0 && entry.height > 0 && entry.width <= (1u << 30) && entry.height <= (1u << 30);
+        if (!ok) break;
+        TextureLevel level = emptyLevel(size_t(entry.width), size_t(entry.height), TexelFormat(entry.format));
+        level.file = file;
+        level.offset = entry.offset;
+        ok = entry.offset % texture_cache_align == 0 && entry.offset <= uint64_t(info.st_size)
+             && levelSize(level) <= uint64_t(info.st_size) - entry.offset;
+        if (!ok) break;
+        level.firstPage = reserveTexturePages(levelPages(level));
+        mipChain->levels.push_back(level);
+    }
+    if (!ok) {
+        fprintf(stderr, "%s : not a texture cache or truncated\n", filename);
+        freeMipChain(mipChain);
+        return NULL;
+    }
+    return mipChain;
+}
+
+Texture *initTexture(const char *filename, TextureCompression compression) {
+    Texture *tex = new Texture;
+    tex->filename = strdup(filename);
+    tex->compression = compression;
+    tex->loaded.store(false, std::memory_order_relaxed);
+    tex->mipChain = NULL;
+    tex->queued = false;
+    return tex;
+}
+
+/* LOAD QUEUE */
+typedef struct texture_queue_s {
+    std::mutex lock;
+    std::condition_variable read; //! a texture taken from pending is read, or a loading thread stopped
+    std::deque<Texture*> pending;
+    size_t threads; //! loading threads, each one stops when pending is empty
+} TextureQueue;
+
+//! never destroyed : a loading thread may still be stopping when the program ends
+static TextureQueue &textureQueue() {
+    static TextureQueue *queue = new TextureQueue();
+    return *queue;
+}
+
+static void loadTextures() {
+    //the loading threads already keep the cores busy, a team for each texture would only compete with them
+    omp_set_num_threads(1);
+    TextureQueue &queue = textureQueue();
+    std::unique_lock<std::mutex> guard(queue.lock);
+    while (!queue.pending.empty()) {
+        Texture *tex = queue.pending.front();
+        queue.pending.pop_front();
+        guard.unlock();
+        textureLevels(tex);
+        guard.lock();
+        tex->queued = false;
+        queue.read.notify_all();
+    }
+    --queue.threads;
+    queue.read.notify_all();
+}
+
+void queueTexture(Texture *tex) {
+    if (tex->loaded.load(std::memory_order_acquire)) return;
+    TextureQueue &queue = textureQueue();
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (tex->queued) return;
+    tex->queued = true;
+    queue.pending.push_back(tex);
+    if (queue.threads < std::max(1u, std::thread::hardware_concurrency())) {
+        ++queue.threads;
+        std::thread(loadTextures).detach();
+    }
+}
+
+//! take tex out of the load queue, waiting for it if it is being read
+static void unqueueTexture(Texture *tex) {
+    TextureQueue &queue = textureQueue();
+    std::unique_lock<std::mutex> guard(queue.lock);
+    auto it = std::find(queue.pending.begin(), queue.pending.end(), tex);
+    if (it != queue.pending.end()) {
+        queue.pending.erase(it);
+        tex->queued = false;
+    }
+    while (tex->queued) queue.read.wait(guard);
+}
+
+void cancelTextureLoads() {
+    TextureQueue &queue = textureQueue();
+    std::unique_lock<std::mutex> guard(queue.lock);
+    for (Texture *tex : queue.pending) tex->queued = false;
+    queue.pending.clear();
+    while (queue.threads > 0) queue.read.wait(guard);
+}
+
+void freeTexture(Texture *tex) {
+    unqueueTexture(tex);
+    if (tex->loaded.load(std::memory_order_acquire) && tex->mipChain)
+        releaseMipChain(tex->mipChain);
+    free(tex->filename);
+    delete tex;
+}
+
+MipChain *textureLevels(Texture *tex) {
+    if (tex->loaded.load(std::memory_order_acquire))
+        return tex->mipChain;
+
+    std::lock_guard<std::mutex> guard(tex->lock);
+    //another thread may have read it while this one waited
+    if (!tex->loaded.load(std::memory_order_relaxed)) {
+        tex->mipChain = acquireMipChain(tex->filename, tex->compression);
+        tex->loaded.store(true, std::memory_order_release);
+    }
+    return tex->mipChain;
+}
+
+//! floor of x as long as it fits in an int, without floorf : the lane loops vectorize on any SSE level
+static inline float floorLane(float x) {
+    float f = float(int(x));
+    return f - (f > x ? 1.f : 0.f);
+}
+
+//! texels i0 and i1 = i0 + 1 (wrapping) around the coordinate t of an axis of size texels, repeating across
+//! the edges, and the weight of i1
+static inline void bilinearAxis(float t, float size, int &i0, int &i1, float &a) {
+    float x = (t - floorLane(t)) * size - 0.5f;
+    float f = floorLane(x);
+    int i = int(f), n = int(size);
+    a = x - f;
+    i0 = i < 0 ? i + n : i;
+    i1 = i0 + 1 < n ? i0 + 1 : 0;
+}
+
+//! degenerate mappings (poles of a sphere) can give NaN
+static inline bool badCoords(float u, float v) {
+    return !(u == u) || !(v == v) || fabsf(u) > 1e6f || fabsf(v) > 1e6f;
+}
+
+//! square of the footprint of the pixel, in texels of a level of width x height
+static inline float footprint2(float dudx, float dvdx, float dudy, float dvdy, float width, float height) {
+    float lengthX2 = dudx * dudx * width * width + dvdx * dvdx * height * height;
+    float lengthY2 = dudy * dudy * width * width + dvdy * dvdy * height * height;
+    return std::max(lengthX2, lengthY2);
+}
+
+//! level (counted from 0, the last one for a larger footprint) and how much of the next one to blend in
+static inline size_t pickLevel(float footprint2, size_t levels, float &blend) {
+    float footprint = sqrtf(footprint2);
+    float lod = footprint > 1.f ? log2f(footprint) : 0.f;
+    blend = 0.f;
+    if (!(lod < float(levels - 1))) return levels - 1;
+    size_t level = size_t(lod);
+    blend = lod - float(level);
+    return level;
+}
+
+//! bilinear between the four texel centers around (u, v), repeating across the edges
+static color3 sampleLevel(const TextureLevel &level, float u, float v) {
+    int x0, x1, y0, y1;
+    float ax, ay;
+    bilinearAxis(u, float(level.width), x0, x1, ax);
+    bilinearAxis(v, float(level.height), y0, y1, ay);
+    color3 top = (1.f - ax) * texelAt(level, x0, y0) + ax * texelAt(level, x1, y0);
+    color3 bottom = (1.f - ax) * texelAt(level, x0, y1) + ax * texelAt(level, x1, y1);
+    return (1.f - ay) * top + ay * bottom;
+}
+
+color3 sampleTexture(Texture *tex, const TexCoord &tc) {
+    float u = tc.u, v = tc.v;
+    if (badCoords(u, v)) u = v = 0.f;
+
+    const std::vector<TextureLevel> &levels = tex->mipChain->levels;
+    float blend;
+    float footprint = footprint2(tc.dudx, tc.dvdx, tc.dudy, tc.dvdy, float(levels[0].width), float(levels[0].height));
+    size_t level = pickLevel(footprint, levels.size(), blend);
+    color3 c = sampleLevel(levels[level], u, v);
+    if (blend > 0.f)
+        c = (1.f - blend) * c + blend * sampleLevel(levels[level + 1], u, v);
+    return c;
+}
+
+//! the four texels of the bilinear footprint of every lane in a level, channel by channel, and their weights
+typedef struct lane_texels_s {
+    float r[4][texture_lanes], g[4][texture_lanes], b[4][texture_lanes];
+    float ax[texture_lanes], ay[texture_lanes];
+} LaneTexels;
+
+//! positions and weights in the lanes of level[i], then the texels gathered lane by lane. the lanes not used
+//! get black texels
+static void gatherLanes(const std::vector<TextureLevel> &levels, const size_t level[texture_lanes], const bool used[texture_lanes],
+                        const float u[texture_lanes], const float v[texture_lanes], LaneTexels &texels) {
+    float width[texture_lanes], height[texture_lanes];
+    for (size_t i = 0; i < texture_lanes; ++i) {
+        width[i] = float(levels[level[i]].width);
+        height[i] = float(levels[level[i]].height);
+    }
+    int x0[texture_lanes], x1[texture_lanes], y0[texture_lanes], y1[texture_lanes];
+    #pragma omp simd
+    for (size_t i = 0; i < texture_lanes; ++i) {
+        bilinearAxis(u[i], width[i], x0[i], x1[i], texels.ax[i]);
+        bilinearAxis(v[i], height[i], y0[i], y1[i], texels.ay[i]);
+    }
+    for (size_t i = 0; i < texture_lanes; ++i) {
+        const TextureLevel &l = levels[level[i]];
+        const int xs[4] = {x0[i], x1[i], x0[i], x1[i]}, ys[4] = {y0[i], y0[i], y1[i], y1[i]};
+        for (int k = 0; k < 4; ++k) {
+            color3 c = used[i] ? texelAt(l, xs[k], ys[k]) : color3(0.f);
+            texels.r[k][i] = c.r;
+            texels.g[k][i] = c.g;
+            texels.b[k][i] = c.b;
+        }
+    }
+}
+
+//! bilinear blend of one channel of the texels of every lane
+static inline void blendLanes(const float t[4][texture_lanes], const float ax[texture_lanes], const float ay[texture_lanes],
+                              float out[texture_lanes]) {
+    #pragma omp simd
+    for (size_t i = 0; i < texture_lanes; ++i) {
+        float top = (1.f - ax[i]) * t[0][i] + ax[i] * t[1][i];
+        float bottom = (1.f - ax[i]) * t[2][i] + ax[i] * t[3][i];
+        out[i] = (1.f - ay[i]) * top + ay[i] * bottom;
+    }
+}
+
+void sampleTextureLanes(Texture *tex, const TexCoord tc[texture_lanes], color3 out[texture_lanes]) {
+    //each coordinate in an array of its own, the lane loops read them in vector registers
+    float u[texture_lanes], v[texture_lanes], dudx[texture_lanes], dvdx[texture_lanes], dudy[texture_lanes], dvdy[texture_lanes];
+    for (size_t i = 0; i < texture_lanes; ++i) {
+        u[i] = tc[i].u;
+        v[i] = tc[i].v;
+        dudx[i] = tc[i].dudx;
+        dvdx[i] = tc[i].dvdx;
+        dudy[i] = tc[i].dudy;
+        dvdy[i] = tc[i].dvdy;
+    }
+    const std::vector<TextureLevel> &levels = tex->mipChain->levels;
+    float width = float(levels[0].width), height = float(levels[0].height), footprints[texture_lanes];
+    #pragma omp simd
+    for (size_t i = 0; i < texture_lanes; ++i) {
+        bool bad = badCoords(u[i], v[i]);
+        u[i] = bad ? 0.f : u[i];
+        v[i] = bad ? 0.f : v[i];
+        footprints[i] = footprint2(dudx[i], dvdx[i], dudy[i], dvdy[i], width, height);
+    }
+
+    size_t level[texture_lanes], next[texture_lanes];
+    float blend[texture_lanes];
+    bool all[texture_lanes], blended[texture_lanes], anyBlended = false;
+    for (size_t i = 0; i < texture_lanes; ++i) {
+        level[i] = pickLevel(footprints[i], levels.size(), blend[i]);
+        blended[i] = blend[i] > 0.f;
+        next[i] = blended[i] ? level[i] + 1 : level[i];
+        all[i] = true;
+        anyBlended |= blended[i];
+    }
+
+    LaneTexels texels;
+    float c[3][texture_lanes], n[3][texture_lanes];
+    gatherLanes(levels, level, all, u, v, texels);
+    blendLanes(texels.r, texels.ax, texels.ay, c[0]);
+    blendLanes(texels.g, texels.ax, texels.ay, c[1]);
+    blendLanes(texels.b, texels.ax, texels.ay, c[2]);
+    //close surfaces magnify the first level : no lane blends in the next one
+    if (anyBlended) {
+        gatherLanes(levels, next, blended, u, v, texels);
+        blendLanes(texels.r, texels.ax, texels.ay, n[0]);
+        blendLanes(texels.g, texels.ax, texels.ay, n[1]);
+        blendLanes(texels.b, texels.ax, texels.ay, n[2]);
+        //the lanes without a next level have a blend of 0 and black texels in it : they keep c
+        for (int k = 0; k < 3; ++k) {
+            #pragma omp simd
+            for (size_t i = 0; i < texture_lanes; ++i)
+                c[k][i] = (1.f - blend[i]) * c[k][i] + blend[i] * n[k][i];
+        }
+    }
+    for (size_t i = 0; i < texture_lanes; ++i)
+        out[i] = color3(c[0][i], c[1][i], c[2][i]);
+}
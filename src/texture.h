@@ -0,0 +1,257 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include "image.h"
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+//! \file : textures of the materials, read from their file the first time they are sampled
+
+//! texels are stored by square tiles of 1 << texture_tile_log texels on a side, the texels of a tile row
+//! after row : a bilinear footprint mostly falls in a single tile
+static const size_t texture_tile_log = 2;
+static const size_t texture_tile = size_t(1) << texture_tile_log;
+//! the tiles are grouped by square pages of 1 << texture_page_log tiles on a side, the pages row after row
+//! and the tiles of a page row after row : a page is the unit read from the file of a paged level
+static const size_t texture_page_log = 3;
+static const size_t texture_page = size_t(1) << texture_page_log;
+
+//! textures are kept tiled on disk in filename + TEXTURE_CACHE_SUFFIX (see writeMipChainCache)
+#define TEXTURE_CACHE_SUFFIX ".mrttex"
+
+//! how the texels of a level are stored. the color formats have 4 channels (the last one unused) so that
+//! texels stay aligned, the block formats keep each tile in a single block
+enum TexelFormat {
+    TEXEL_RGB8, //! 8 bits per channel, read as a linear value in [0,1] : images decoded from 8 bit files
+    TEXEL_RGB16F, //! half float per channel : images computed in float
+    TEXEL_BC1, //! 8 byte blocks (as BC1 / DXT1) : 2 colors in 5:6:5 bits, 2 bits per texel to pick one of 4 colors between them
+    TEXEL_BC5, //! 16 byte blocks (as BC5) : x and y of a unit vector, each one as BC1 colors but with 2 values in 8 bits and
+               //! 3 bits per texel, z rebuilt from them. read as the vector, in [-1,1]
+    TEXEL_OCT16, //! unit vector folded on an octahedron, its 2 coordinates in 16 bits. read as the vector, in [-1,1]
+    TEXEL_R16F //! a single half float, read in the 3 channels
+};
+
+//! optional compression or preprocessing of a texture when it is read. normal maps are read as unit vectors
+//! in the tangent space, normalize(r - 0.5, g - 0.5, b) of their colors
+enum TextureCompression {
+    TEXTURE_UNCOMPRESSED,
+    TEXTURE_COLOR_BLOCKS, //! TEXEL_BC1, 4 bits per texel
+    TEXTURE_NORMAL_BLOCKS, //! normal map in TEXEL_BC5, 8 bits per texel
+    TEXTURE_UNIT_NORMALS, //! normal map in TEXEL_OCT16, 32 bits per texel
+    TEXTURE_ROUGHNESS //! roughness map in TEXEL_R16F : the alpha of the microfacets, 0.1 over the mean of the
+                      //! channels and at most 0.7
+};
+
+//! one level of a texture
+typedef struct texture_level_s {
+    size_t width, height;
+    size_t tilesX; //! tiles in a row of tiles, the last one may be partly outside the level
+    size_t pagesX; //! pages in a row of pages, the tiles of a page outside the level are left at 0
+    TexelFormat format;
+    unsigned char *texels; //! see texelIndex for the layout, NULL for a paged level
+    //! paged levels : their pages are read from file at offset when sampled, and kept in the page cache
+    //! (see pagecache.h) under the keys firstPage, firstPage + 1...
+    int file;
+    uint64_t offset;
+    uint64_t firstPage;
+} TextureLevel;
+
+//! the levels of a texture : levels[0] at the size of the image, each next level half the size of the previous
+//! one, down to 1x1. shared by every Texture of the same file, see acquireMipChain
+typedef struct mip_chain_s {
+    std::vector<TextureLevel> levels;
+    int file; //! the levels are paged from this file (see loadMipChainCache), -1 if they are in memory
+} MipChain;
+
+typedef struct texture_s {
+    char *filename;
+    TextureCompression compression;
+    std::atomic<bool> loaded; //! mipChain is set (possibly to NULL), it does not change anymore
+    MipChain *mipChain; //! held from the asset cache once loaded
+    std::mutex lock; //! taken by the first samples only, while the file is read
+    bool queued; //! waiting in the load queue or being read from it, see queueTexture
+} Texture;
+
+//! texture coordinates of a shaded point, with their change from one pixel to the next along x and y on the image
+typedef struct tex_coord_s {
+    float u, v;
+    float dudx, dvdx;
+    float dudy, dvdy;
+} TexCoord;
+
+//! number of texture coordinates sampleTextureLanes takes at once
+static const size_t texture_lanes = 8;
+
+//! value of each 8 bit channel, i/255
+extern const float texel_unorm8[256];
+
+inline float halfToFloat(uint16_t h) {
+    //moves exponent and mantissa in place, then scales by 2^(127-15) : denormals come out right too
+    uint32_t bits = uint32_t(h & 0x7fffu) << 13;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    f *= 5.192296858534828e+33f;
+    memcpy(&bits, &f, sizeof(f));
+    if ((h & 0x7fffu) >= 0x7c00u) bits |= 0x7f800000u; //infinity or NaN
+    bits |= uint32_t(h & 0x8000u) << 16;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+//! nearest half float, ties to even
+uint16_t floatToHalf(float f);
+
+//! position of tile (tx, ty) in the tiles of level
+inline size_t tileIndex(const TextureLevel &level, size_t tx, size_t ty) {
+    size_t page = (ty >> texture_page_log) * level.pagesX + (tx >> texture_page_log);
+    size_t inPage = ((ty & (texture_page - 1)) << texture_page_log) + (tx & (texture_page - 1));
+    return (page << (2 * texture_page_log)) + inPage;
+}
+
+//! position of texel (x, y) in the texels of level, counted in texels
+inline size_t texelIndex(const TextureLevel &level, size_t x, size_t y) {
+    size_t tile = tileIndex(level, x >> texture_tile_log, y >> texture_tile_log);
+    size_t inTile = ((y & (texture_tile - 1)) << texture_tile_log) + (x & (texture_tile - 1));
+    return (tile << (2 * texture_tile_log)) + inTile;
+}
+
+inline size_t tileBytes(TexelFormat format) {
+    switch (format) {
+        case TEXEL_RGB8: return 4 * texture_tile * texture_tile;
+        case TEXEL_RGB16F: return 4 * sizeof(uint16_t) * texture_tile * texture_tile;
+        case TEXEL_BC1: return 8;
+        case TEXEL_BC5: return 16;
+        case TEXEL_OCT16: return 2 * sizeof(uint16_t) * texture_tile * texture_tile;
+        default: return sizeof(uint16_t) * texture_tile * texture_tile;
+    }
+}
+
+//! texels of tile of a paged level, read through the page cache
+const unsigned char *pagedTile(const TextureLevel &level, size_t tile);
+
+inline const unsigned char *tileTexels(const TextureLevel &level, size_t tile) {
+    if (level.texels) return level.texels + tile * tileBytes(level.format);
+    return pagedTile(level, tile);
+}
+
+inline color3 bc1Color(unsigned c) {
+    return color3(float(c >> 11) / 31.f, float((c >> 5) & 63u) / 63.f, float(c & 31u) / 31.f);
+}
+
+//! texel i (row after row) of a TEXEL_BC1 block
+inline color3 bc1Texel(const unsigned char *block, size_t i) {
+    unsigned c0 = block[0] | unsigned(block[1]) << 8, c1 = block[2] | unsigned(block[3]) << 8;
+    unsigned index = (block[4 + (i >> 2)] >> (2 * (i & 3))) & 3u;
+    switch (index) {
+        case 0: return bc1Color(c0);
+        case 1: return bc1Color(c1);
+        case 2: return c0 > c1 ? (2.f * bc1Color(c0) + bc1Color(c1)) * (1.f/3.f) : 0.5f * (bc1Color(c0) + bc1Color(c1));
+        default: return c0 > c1 ? (bc1Color(c0) + 2.f * bc1Color(c1)) * (1.f/3.f) : color3(0.f);
+    }
+}
+
+//! value i (row after row) of a single channel half of a TEXEL_BC5 block
+inline float bc4Value(const unsigned char *block, size_t i) {
+    float e0 = float(block[0]), e1 = float(block[1]);
+    size_t bit = 3 * i;
+    unsigned bits = block[2 + (bit >> 3)];
+    if ((bit & 7) > 5) bits |= unsigned(block[3 + (bit >> 3)]) << 8;
+    unsigned index = (bits >> (bit & 7)) & 7u;
+    if (index < 2) return texel_unorm8[block[index]];
+    if (block[0] > block[1]) return (float(8 - index) * e0 + float(index - 1) * e1) * (1.f/(7.f * 255.f));
+    if (index >= 6) return index == 6 ? 0.f : 1.f;
+    return (float(6 - index) * e0 + float(index - 1) * e1) * (1.f/(5.f * 255.f));
+}
+
+inline vec3 bc5Texel(const unsigned char *block, size_t i) {
+    float x = 2.f * bc4Value(block, i) - 1.f, y = 2.f * bc4Value(block + 8, i) - 1.f;
+    return vec3(x, y, std::sqrt(std::max(0.f, 1.f - x * x - y * y)));
+}
+
+//! unit vector of the octahedral coordinates of a TEXEL_OCT16 texel, unfolding the lower half
+inline vec3 octTexel(const uint16_t *p) {
+    float x = float(p[0]) * (2.f/65535.f) - 1.f, y = float(p[1]) * (2.f/65535.f) - 1.f;
+    float z = 1.f - std::fabs(x) - std::fabs(y);
+    if (z < 0.f) {
+        float fx = (1.f - std::fabs(y)) * (x < 0.f ? -1.f : 1.f);
+        y = (1.f - std::fabs(x)) * (y < 0.f ? -1.f : 1.f);
+        x = fx;
+    }
+    return vec3(x, y, z) * (1.f / std::sqrt(x * x + y * y + z * z));
+}
+
+inline color3 texelAt(const TextureLevel &level, size_t x, size_t y) {
+    size_t i = texelIndex(level, x, y);
+    const unsigned char *tile = tileTexels(level, i >> (2 * texture_tile_log));
+    i &= texture_tile * texture_tile - 1;
+    switch (level.format) {
+        case TEXEL_RGB8: {
+            const unsigned char *p = tile + 4 * i;
+            return color3(texel_unorm8[p[0]], texel_unorm8[p[1]], texel_unorm8[p[2]]);
+        }
+        case TEXEL_RGB16F: {
+            const uint16_t *p = (const uint16_t *)tile + 4 * i;
+            return color3(halfToFloat(p[0]), halfToFloat(p[1]), halfToFloat(p[2]));
+        }
+        //one block per tile
+        case TEXEL_BC1:
+            return bc1Texel(tile, i);
+        case TEXEL_BC5:
+            return bc5Texel(tile, i);
+        case TEXEL_OCT16:
+            return octTexel((const uint16_t *)tile + 2 * i);
+        default:
+            return color3(halfToFloat(((const uint16_t *)tile)[i]));
+    }
+}
+
+//! bytes taken by the texels of every level (on disk for a paged chain)
+size_t mipChainSize(const MipChain *mipChain);
+
+//! levels of img (which is not kept) in TEXEL_RGB16F, the first one a tiled copy of it, the others box filtered
+//! from the previous one
+MipChain *initMipChain(const Image *img);
+//! same in TEXEL_RGB8, from 8 bit RGB texels row after row
+MipChain *initMipChainBytes(const unsigned char *rgb, size_t width, size_t height);
+void freeMipChain(MipChain *mipChain);
+//! replace the levels of mipChain by their compressed blocks or preprocessed texels, encoded from their texels
+void compressMipChain(MipChain *mipChain, TextureCompression compression);
+
+//! write the levels of mipChain (in memory) to filename, tiled as they are : each level starts on a disk page
+bool writeMipChainCache(const char *filename, const MipChain *mipChain);
+//! paged levels of a cache written by writeMipChainCache, only its level table is read.
+//! NULL (with a message) if the file cannot be read or is not a texture cache
+MipChain *loadMipChainCache(const char *filename);
+
+//! tangent space unit normal of a normal map color, as TEXTURE_UNIT_NORMALS and TEXTURE_NORMAL_BLOCKS read it
+vec3 unitNormal(color3 c);
+//! Beckmann alpha of a roughness map color, as TEXTURE_ROUGHNESS reads it
+float roughnessAlpha(color3 c);
+
+//! handle on the texture of filename : nothing is read until textureLevels
+Texture *initTexture(const char *filename, TextureCompression compression = TEXTURE_UNCOMPRESSED);
+//! release the levels of tex (if they were read) and free tex itself
+void freeTexture(Texture *tex);
+
+//! levels of tex, read on the first call (see acquireMipChain), NULL if the file cannot be read.
+//! safe from several threads at once, without locking once the levels are there
+MipChain *textureLevels(Texture *tex);
+
+//! read the levels of tex on a loading thread, the first textureLevels then only waits for them if they are
+//! not there yet. several textures are read at once, one per core
+void queueTexture(Texture *tex);
+//! drop the textures still waiting in the load queue and wait for those being read
+void cancelTextureLoads();
+
+//! color of tex at tc (or what its format reads as), coordinates repeating outside [0,1] : bilinear in the two levels closest to the size
+//! of the pixel footprint, blended. tex must have been read (textureLevels not NULL)
+color3 sampleTexture(Texture *tex, const TexCoord &tc);
+//! sampleTexture at texture_lanes coordinates at once (hits of neighboring rays), the same values : the levels,
+//! positions and weights are computed in vector lanes, the texels gathered then blended in lanes too
+void sampleTextureLanes(Texture *tex, const TexCoord tc[texture_lanes], color3 out[texture_lanes]);
+
+#endif
@@ -3,12 +3,23 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <iostream>
+#include <algorithm>
 #include "defines.h"
 #include "ray.h"
 #include "scene.h"
+#include "scene_types.h"
 #include "raytracer.h"
 #include "image.h"
+#include "mesh.h"
+#include "meshio.h"
+#include "assets.h"
+#include "texture.h"
+#include "pagecache.h"
+#include "pngwrite.h"
+#include <lodepng.h>
 
 #include "expected.h"
 
@@ -58,27 +69,487 @@ int main(void){
   Object *sphere2 = initSphere(vec3(1, 1, 1), 0.5, dummy);
 
   Ray r;
-  Intersection dummyInter;
+  Hit dummyHit;
 
-  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to sphere1", intersectSphere(&r, &dummyInter, sphere1), true);
-  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to sphere2", intersectSphere(&r, &dummyInter, sphere2), false);
-  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to plane1", intersectPlane(&r, &dummyInter, plane1), false);
-  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to plane2", intersectPlane(&r, &dummyInter, plane2), false);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to sphere1", intersectSphere(&r, &dummyHit, sphere1), true);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to sphere2", intersectSphere(&r, &dummyHit, sphere2), false);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to plane1", intersectPlane(&r, &dummyHit, plane1), false);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to plane2", intersectPlane(&r, &dummyHit, plane2), false);
 
-  rayInit(&r, point3(0,0,0), vec3(1,0,0), 0.01, 0.02); validTest("r1 to sphere1", intersectSphere(&r, &dummyInter, sphere1), false);
-  rayInit(&r, point3(0,0,0), vec3(1,0,0), 0.01, 0.02); validTest("r1 to sphere2", intersectSphere(&r, &dummyInter, sphere2), false);
-  rayInit(&r, point3(0,0,0), vec3(1,0,0), 0.01, 0.02); validTest("r1 to plane1", intersectPlane(&r, &dummyInter, plane1), false);
-  rayInit(&r, point3(0,0,0), vec3(1,0,0), 0.01, 0.02); validTest("r1 to plane2", intersectPlane(&r, &dummyInter, plane2), false);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0), 0.01, 0.02); validTest("r1 to sphere1", intersectSphere(&r, &dummyHit, sphere1), false);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0), 0.01, 0.02); validTest("r1 to sphere2", intersectSphere(&r, &dummyHit, sphere2), false);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0), 0.01, 0.02); validTest("r1 to plane1", intersectPlane(&r, &dummyHit, plane1), false);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0), 0.01, 0.02); validTest("r1 to plane2", intersectPlane(&r, &dummyHit, plane2), false);
 
-  rayInit(&r, point3(2,2,2), vec3(-1,-1,0-1)); validTest("r2 to sphere1", intersectSphere(&r, &dummyInter, sphere1), true);
-  rayInit(&r, point3(2,2,2), vec3(-1,-1,0-1)); validTest("r2 to sphere2", intersectSphere(&r, &dummyInter, sphere2), true);
-  rayInit(&r, point3(2,2,2), vec3(-1,-1,0-1)); validTest("r2 to plane1", intersectPlane(&r, &dummyInter, plane1), true);
-  rayInit(&r, point3(2,2,2), vec3(-1,-1,0-1)); validTest("r2 to plane2", intersectPlane(&r, &dummyInter, plane2), true);
+  rayInit(&r, point3(2,2,2), vec3(-1,-1,0-1)); validTest("r2 to sphere1", intersectSphere(&r, &dummyHit, sphere1), true);
+  rayInit(&r, point3(2,2,2), vec3(-1,-1,0-1)); validTest("r2 to sphere2", intersectSphere(&r, &dummyHit, sphere2), true);
+  rayInit(&r, point3(2,2,2), vec3(-1,-1,0-1)); validTest("r2 to plane1", intersectPlane(&r, &dummyHit, plane1), true);
+  rayInit(&r, point3(2,2,2), vec3(-1,-1,0-1)); validTest("r2 to plane2", intersectPlane(&r, &dummyHit, plane2), true);
+
+  Object *box1 = initBox(vec3(3,0,0), vec3(0.5,0.5,0.5), dummy);
+  Object *box2 = initOrientedBox(vec3(3,0.9,0), vec3(0.5,0.5,0.5), vec3(1,1,0), vec3(-1,1,0), dummy);
+  Object *cylinder1 = initCylinder(vec3(3,-1,0), vec3(0,1,0), 0.5, 2, dummy);
+  Object *quad1 = initQuad(vec3(3,-1,-1), vec3(3,1,-1), vec3(3,1,1), vec3(3,-1,1), dummy);
+  Object *quad2 = initQuad(vec3(3,-1,-1), vec3(3,1,-1), vec3(4,1,1), vec3(3,-1,1), dummy);
+  Object *disk1 = initDisk(vec3(3,0,0), vec3(-1,0,0), 0.5, dummy);
+
+  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to box1", intersectBox(&r, &dummyHit, box1), true);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to box2", intersectBox(&r, &dummyHit, box2), false);
+  rayInit(&r, point3(0,0.3,0), vec3(1,0,0)); validTest("r3 to box2", intersectBox(&r, &dummyHit, box2), true);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to cylinder1", intersectCylinder(&r, &dummyHit, cylinder1), true);
+  rayInit(&r, point3(3,5,0), vec3(0,-1,0)); validTest("r4 to cylinder1 cap", intersectCylinder(&r, &dummyHit, cylinder1) && dummyHit.prim == 2, true);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to disk1", intersectDisk(&r, &dummyHit, disk1), true);
+  rayInit(&r, point3(0,0.6,0), vec3(1,0,0)); validTest("r5 to disk1", intersectDisk(&r, &dummyHit, disk1), false);
+  rayInit(&r, point3(0,0,0), vec3(1,0,0)); validTest("r0 to quad1", intersectQuad(&r, &dummyHit, quad1) && abs(dummyHit.t - 3.f) < 0.0001f, true);
+  rayInit(&r, point3(0,1.5,0), vec3(1,0,0)); validTest("r7 to quad1", intersectQuad(&r, &dummyHit, quad1), false);
+  rayInit(&r, point3(0,0.5,0.5), vec3(1,0,0)); validTest("r8 to quad2", intersectQuad(&r, &dummyHit, quad2) && abs(dummyHit.t - 3.5625f) < 0.0001f, true);
+  rayInit(&r, point3(3,0,0), vec3(1,0,0)); validTest("r6 inside box1", intersectBox(&r, &dummyHit, box1) && abs(dummyHit.t - 0.5f) < 0.0001f, true);
 
   freeObject(plane1);
   freeObject(plane2);
   freeObject(sphere1);
   freeObject(sphere2);
+  freeObject(box1);
+  freeObject(box2);
+  freeObject(cylinder1);
+  freeObject(quad1);
+  freeObject(quad2);
+  freeObject(disk1);
+
+  //a flat 10x10 grid must simplify to a few triangles, staying flat and keeping its borders
+  MeshData grid, coarse;
+  for (int y = 0 ; y < 11 ; ++y)
+    for (int x = 0 ; x < 11 ; ++x)
+      grid.positions.push_back(vec3(x, 0, y));
+  for (unsigned y = 0 ; y < 10 ; ++y)
+    for (unsigned x = 0 ; x < 10 ; ++x) {
+      unsigned q[4] = {x+y*11, x+1+y*11, x+1+(y+1)*11, x+(y+1)*11};
+      grid.quads.insert(grid.quads.end(), q, q+4);
+    }
+  simplifyMeshData(&grid, 20, &coarse);
+  bool flat = meshDataFaceCount(&coarse) <= 20 && meshDataFaceCount(&coarse) >= 2;
+  vec3 cmin(100.f), cmax(-100.f);
+  for (vec3 p : coarse.positions) { flat &= p.y == 0.f; cmin = min(cmin, p); cmax = max(cmax, p); }
+  validTest("simplify grid", flat && cmin == vec3(0,0,0) && cmax == vec3(10,0,10), true);
+
+  //a 5x5 ramp along x, rising from 0 to 1 over 4 units
+  Scene *hfScene = initScene();
+  Image *ramp = initImage(5, 5);
+  for (size_t y = 0 ; y < 5 ; ++y)
+    for (size_t x = 0 ; x < 5 ; ++x)
+      *getPixelPtr(ramp, x, y) = color3(x / 4.f);
+  initHeightfield(hfScene, ramp, vec3(0,0,0), vec3(4,1,4), dummy);
+  Object *hf1 = hfScene->objects[0];
+  rayInit(&r, point3(2,5,1.5), vec3(0,-1,0)); validTest("r9 to heightfield1", intersectHeightfield(&r, &dummyHit, hf1) && abs(dummyHit.t - 4.5f) < 0.0001f, true);
+  rayInit(&r, point3(-1,0.9,2), vec3(1,0,0)); validTest("r10 to heightfield1", intersectHeightfield(&r, &dummyHit, hf1) && abs(dummyHit.t - 4.6f) < 0.0001f, true);
+  rayInit(&r, point3(-1,1.5,2), vec3(1,0,0)); validTest("r11 over heightfield1", intersectHeightfield(&r, &dummyHit, hf1), false);
+  freeScene(hfScene);
+  freeImage(ramp);
+
+  //OBJ faces : negative indices, texture/normal indices ignored, pentagon split in a fan
+  FILE *obj = fopen("unit-test.obj", "w");
+  fprintf(obj, "# test\nv 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\r\nv -1.5e-1 .5 +2\nvt 0 0\n"
+               "f -5 -4 -3\nf 1/1 2/1 3/1 4/1\nf 1//1 2//1 3//1 4//1 5//1\n");
+  fclose(obj);
+  MeshData objData;
+  validTest("load obj", loadObj("unit-test.obj", &objData) && objData.positions.size() == 5
+            && objData.positions[4] == vec3(-0.15f, 0.5f, 2.f) && objData.triangles.size() == 12
+            && objData.quads.size() == 4 && objData.triangles[11] == 4, true);
+  remove("unit-test.obj");
+
+  //a transformed mesh, quantized, is hit where its full precision triangle is
+  FILE *triObj = fopen("unit-test-tri.obj", "w");
+  fprintf(triObj, "v -0.731 0.127 0.25\nv 1.4137 -0.3 0.61\nv 0.2 1.333 -0.47\nf 1 2 3\n");
+  fclose(triObj);
+  Scene *meshScene = initScene();
+  initComplex(meshScene, "unit-test-tri.obj", dummy, 1.7f, vec3(0.3f, -1.2f, 2.5f), 0.6f);
+  bool meshHitOk = meshScene->objects.size() == 1;
+  if (meshHitOk) {
+    Object *meshObj = meshScene->objects[0];
+    vec3 v[3] = {vec3(-0.731f, 0.127f, 0.25f), vec3(1.4137f, -0.3f, 0.61f), vec3(0.2f, 1.333f, -0.47f)};
+    for (vec3 &p : v) p = meshObj->tranlation + meshObj->orientation * p;
+    addTriangle(meshScene, v[0], v[1], v[2], dummy);
+    Object *fullObj = meshScene->objects[1];
+    point3 target = (v[0] + 2.f * v[1] + 3.f * v[2]) / 6.f, origin = target + vec3(0.4f, 2.f, -1.5f);
+    Ray meshRay, fullRay;
+    rayInit(&meshRay, origin, target - origin);
+    rayInit(&fullRay, origin, target - origin);
+    Hit meshHit, fullHit;
+    meshHitOk = intersectMesh(&meshRay, &meshHit, meshObj) && intersectTriangle(&fullRay, &fullHit, fullObj);
+    if (meshHitOk) {
+      Intersection meshInter, fullInter;
+      computeIntersection(&meshRay, &meshHit, &meshInter);
+      computeIntersection(&fullRay, &fullHit, &fullInter);
+      meshHitOk = abs(meshHit.t - fullHit.t) < 1e-4f && length(meshInter.position - fullInter.position) < 1e-4f
+                  && dot(meshInter.baseNormal, fullInter.baseNormal) > 0.99999f;
+    }
+  }
+  validTest("transformed mesh hit", meshHitOk, true);
+  freeScene(meshScene);
+  purgeAssets();
+  //an OBJ rewritten within the second its cache was written is parsed again
+  Mesh *firstMesh = initMesh(), *rewrittenMesh = initMesh();
+  bool rewrittenOk = loadMesh("unit-test-tri.obj", firstMesh);
+  triObj = fopen("unit-test-tri.obj", "w");
+  fprintf(triObj, "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3\nf 1 3 4\n");
+  fclose(triObj);
+  struct timespec cacheTimes[2] = {{1700000000, 100000000}, {1700000000, 100000000}};
+  struct timespec objTimes[2] = {{1700000000, 600000000}, {1700000000, 600000000}};
+  rewrittenOk &= utimensat(AT_FDCWD, "unit-test-tri.obj" MESH_CACHE_SUFFIX, cacheTimes, 0) == 0
+                 && utimensat(AT_FDCWD, "unit-test-tri.obj", objTimes, 0) == 0
+                 && loadMesh("unit-test-tri.obj", rewrittenMesh) && meshLodFaceCount(&firstMesh->lods[0]) == 1
+                 && meshLodFaceCount(&rewrittenMesh->lods[0]) == 2;
+  validTest("mesh cache of the same second", rewrittenOk, true);
+  freeMesh(firstMesh);
+  freeMesh(rewrittenMesh);
+  remove("unit-test-tri.obj");
+  remove("unit-test-tri.obj" MESH_CACHE_SUFFIX);
+
+  //quantized vertices decode within half a step of their position
+  MeshData scattered;
+  for (int i = 0 ; i < 200 ; ++i)
+    scattered.positions.push_back(vec3(sinf(i * 1.7f) * 13.f - 4.f, cosf(i * 0.37f) * 0.02f + 7.f, fmodf(i * 0.618f, 1.f) * 250.f));
+  for (unsigned i = 0 ; i + 2 < 200 ; i += 3) scattered.triangles.insert(scattered.triangles.end(), {i, i + 1, i + 2});
+  Mesh *quantized = initMesh();
+  buildMeshLods(quantized, &scattered);
+  bool roundTripOk = true;
+  for (const vec3 &p : scattered.positions) {
+    uint16_t q[3];
+    quantizeMeshVertex(quantized, p, q);
+    MeshLod single = quantized->lods[0];
+    single.positions = q;
+    vec3 error = abs(meshVertex(quantized, &single, 0) - p);
+    vec3 halfStep = 0.5f * quantized->quantScale + 1e-6f * (abs(p) + 1.f);
+    roundTripOk &= error.x <= halfStep.x && error.y <= halfStep.y && error.z <= halfStep.z;
+  }
+  validTest("quantized vertex", roundTripOk, true);
+  freeMesh(quantized);
+
+  //a grid large enough to be parsed in several chunks, rows of faces pointing back to the previous row
+  //with relative indices : they must resolve across chunk boundaries
+  const unsigned side = 400;
+  obj = fopen("unit-test.obj", "w");
+  for (unsigned y = 0 ; y < side ; ++y) {
+    for (unsigned x = 0 ; x < side ; ++x) fprintf(obj, "v %u 0.000000 %u\n", x, y);
+    if (y == 0) continue;
+    for (unsigned x = 0 ; x + 1 < side ; ++x)
+      fprintf(obj, "f %d %d %d %d\n", int(x) - int(2*side), int(x) + 1 - int(2*side), int(x) + 1 - int(side), int(x) - int(side));
+  }
+  fclose(obj);
+  MeshData bigObj;
+  bool bigOk = loadObj("unit-test.obj", &bigObj) && bigObj.positions.size() == side * side && bigObj.quads.size() == 4 * (side - 1) * (side - 1);
+  for (size_t i = 0 ; bigOk && i < bigObj.quads.size() ; i += 4) {
+    const vec3 &p0 = bigObj.positions[bigObj.quads[i]], &p2 = bigObj.positions[bigObj.quads[i+2]];
+    bigOk = p2 - p0 == vec3(1, 0, 1);
+  }
+  validTest("load obj in chunks", bigOk, true);
+  Mesh *streamed = initMesh(), *loaded = initMesh();
+  buildMeshLods(loaded, &bigObj);
+  bool streamOk = streamObj("unit-test.obj", streamed) && streamed->lods.size() == 1
+                  && streamed->bmin == loaded->bmin && streamed->bmax == loaded->bmax;
+  if (streamOk) {
+    const MeshLod &a = streamed->lods[0], &b = loaded->lods[0];
+    streamOk = a.vertexCount == b.vertexCount && a.quadCount == b.quadCount && a.triangleCount == b.triangleCount
+               && memcmp(a.positions, b.positions, a.vertexCount * 3 * sizeof(uint16_t)) == 0
+               && memcmp(a.quads, b.quads, a.quadCount * 4 * sizeof(unsigned)) == 0;
+  }
+  validTest("stream obj", streamOk, true);
+  freeMesh(streamed);
+  freeMesh(loaded);
+  remove("unit-test.obj");
+
+  //the same PLY in both byte orders, with an extra vertex property : a triangle, a quad and a pentagon
+  const uint16_t one = 1;
+  bool hostBig = *(const uint8_t *)&one == 0, plyOk = true;
+  for (int big = 0 ; big < 2 ; ++big) {
+    FILE *ply = fopen("unit-test.ply", "wb");
+    fprintf(ply, "ply\nformat %s 1.0\ncomment test\nelement vertex 5\nproperty float x\nproperty float y\nproperty float z\n"
+                 "property uchar red\nelement face 3\nproperty list uchar int vertex_indices\nend_header\n",
+            big ? "binary_big_endian" : "binary_little_endian");
+    auto put = [&](const void *v, size_t size) {
+      unsigned char b[4];
+      memcpy(b, v, size);
+      if (bool(big) != hostBig) std::reverse(b, b + size);
+      fwrite(b, 1, size, ply);
+    };
+    float xyz[5][3] = {{0,0,0}, {1,0,0}, {1,1,0}, {0,1,0}, {-0.15f,0.5f,2}};
+    unsigned char red = 255;
+    for (int i = 0 ; i < 5 ; ++i) { put(xyz[i], 4); put(xyz[i]+1, 4); put(xyz[i]+2, 4); put(&red, 1); }
+    for (unsigned char n = 3 ; n <= 5 ; ++n) {
+      put(&n, 1);
+      for (int32_t k = 0 ; k < n ; ++k) put(&k, 4);
+    }
+    fclose(ply);
+    MeshData plyData;
+    plyOk &= loadPly("unit-test.ply", &plyData) && plyData.positions.size() == 5 && plyData.positions[4] == vec3(-0.15f, 0.5f, 2.f)
+             && plyData.triangles.size() == 12 && plyData.quads.size() == 4 && plyData.quads[3] == 3 && plyData.triangles[11] == 4;
+  }
+  validTest("load ply", plyOk, true);
+  //headers announcing more vertices than the file holds are rejected before anything is allocated,
+  //with fixed records or with lists
+  bool shortPly = true;
+  for (int lists = 0 ; lists < 2 ; ++lists) {
+    FILE *ply = fopen("unit-test.ply", "wb");
+    fprintf(ply, "ply\nformat binary_little_endian 1.0\nelement vertex 400000000000\nproperty float x\nproperty float y\n"
+                 "property float z\n%send_header\n", lists ? "property list uchar int extra\n" : "");
+    fwrite("\0\0\0\0\0\0\0\0\0\0\0\0", 1, 12, ply);
+    fclose(ply);
+    MeshData plyData;
+    shortPly &= !loadPly("unit-test.ply", &plyData) && plyData.positions.empty();
+  }
+  validTest("short ply", shortPly, true);
+  remove("unit-test.ply");
+
+  //assets are shared whatever the path used to reach them
+  FILE *ppm = fopen("unit-test.ppm", "w");
+  fprintf(ppm, "P3\n2 1\n255\n255 0 0  0 0 255\n");
+  fclose(ppm);
+  Image *asset1 = acquireImage("unit-test.ppm"), *asset2 = acquireImage("./unit-test.ppm");
+  validTest("shared image", asset1 != NULL && asset1 == asset2 && asset1->data[1] == color3(0,0,1), true);
+  //a texture is only read when sampled, its levels are shared by the textures of the same file
+  Texture *lazy = initTexture("unit-test.ppm"), *lazy2 = initTexture("./unit-test.ppm");
+  bool notRead = !lazy->loaded;
+  validTest("lazy texture", notRead && textureLevels(lazy) != NULL && textureLevels(lazy) == textureLevels(lazy2), true);
+  //a footprint of the whole texture reads the last level, the average of the texels
+  TexCoord texel = {0.25f, 0.5f, 0.f, 0.f, 0.f, 0.f}, wide = {0.25f, 0.5f, 1.f, 0.f, 0.f, 1.f};
+  validTest("mip levels", lazy->mipChain->levels.size() == 2 && sampleTexture(lazy, texel) == color3(1,0,0)
+            && length(sampleTexture(lazy, wide) - color3(128/255.f,0,128/255.f)) < 1e-6f, true);
+  //queued textures are read by loading threads, a texture can be freed while it is read
+  Texture *queued = initTexture("unit-test.ppm"), *dropped = initTexture("unit-test.ppm", TEXTURE_COLOR_BLOCKS);
+  queueTexture(queued);
+  queueTexture(dropped);
+  freeTexture(dropped);
+  validTest("queued texture", textureLevels(queued) == lazy->mipChain, true);
+  freeTexture(queued);
+  freeTexture(lazy2);
+  freeTexture(lazy);
+  releaseImage(asset1);
+  releaseImage(asset2);
+  purgeAssets();
+  remove("unit-test.ppm");
+
+  //binary 8 bit PPM texels are read in place, 16 bit PGM grey levels fill the 3 channels
+  FILE *binaryPpm = fopen("unit-test.ppm", "wb");
+  fprintf(binaryPpm, "P6\n# baked\n2 1\n255\n");
+  fwrite("\xff\x00\x00\x00\x00\xff", 1, 6, binaryPpm);
+  fclose(binaryPpm);
+  Image *binary = loadImagePPM((char *)"unit-test.ppm");
+  ImageBytes binaryBytes;
+  bool inPlace = loadImageBytes("unit-test.ppm", &binaryBytes) && binaryBytes.buffer == NULL && binaryBytes.width == 2
+                 && binaryBytes.rgb[0] == 255 && binaryBytes.rgb[5] == 255 && binaryBytes.rgb[3] == 0;
+  validTest("binary ppm", binary != NULL && binary->data[0] == color3(1,0,0) && binary->data[1] == color3(0,0,1) && inPlace, true);
+  if (inPlace) freeImageBytes(&binaryBytes);
+  if (binary) freeImage(binary);
+  remove("unit-test.ppm");
+  FILE *pgm = fopen("unit-test.pgm", "wb");
+  fprintf(pgm, "P5 2 1 65535\n");
+  fwrite("\xff\xff\x80\x00", 1, 4, pgm);
+  fclose(pgm);
+  Image *wideGrey = loadImagePPM((char *)"unit-test.pgm");
+  ImageBytes wideBytes;
+  validTest("16 bit pgm", wideGrey != NULL && wideGrey->data[0] == color3(1) && wideGrey->data[1] == color3(32768/65535.f)
+            && !loadImageBytes("unit-test.pgm", &wideBytes) && wideBytes.width == 2, true);
+  if (wideGrey) freeImage(wideGrey);
+  remove("unit-test.pgm");
+  //an ASCII header announcing more texels than the file holds is rejected before anything is allocated
+  FILE *hugePpm = fopen("unit-test.ppm", "w");
+  fprintf(hugePpm, "P3 1048576 1048576 255\n1 2 3\n");
+  fclose(hugePpm);
+  Image *huge = loadImagePPM((char *)"unit-test.ppm");
+  validTest("short ascii ppm", huge == NULL, true);
+  //ASCII samples above the maximum are clamped, as binary ones are
+  FILE *brightPgm = fopen("unit-test.ppm", "w");
+  fprintf(brightPgm, "P2 2 1 100\n50 300\n");
+  fclose(brightPgm);
+  Image *bright = loadImagePPM((char *)"unit-test.ppm");
+  validTest("ascii ppm above its maximum", bright != NULL && bright->data[0] == color3(0.5f) && bright->data[1] == color3(1.f), true);
+  if (bright) freeImage(bright);
+  remove("unit-test.ppm");
+
+  //8 coordinates at once give what they give one by one, whatever their level, footprint or wrapping
+  FILE *lanesPpm = fopen("unit-test-lanes.ppm", "w");
+  fprintf(lanesPpm, "P3\n16 8\n255\n");
+  for (int i = 0; i < 16*8; ++i) fprintf(lanesPpm, "%d %d %d\n", (i * 37) % 256, (i * 91) % 256, (i * 13) % 256);
+  fclose(lanesPpm);
+  Texture *lanesTex = initTexture("unit-test-lanes.ppm");
+  TexCoord lanes[texture_lanes] = {{0.1f, 0.2f, 0.f, 0.f, 0.f, 0.f}, {0.93f, 0.97f, 0.02f, 0.f, 0.f, 0.03f},
+                                   {-1.37f, 2.6f, 0.1f, 0.f, 0.f, 0.1f}, {0.5f, 0.5f, 1.f, 0.f, 0.f, 1.f},
+                                   {NAN, 0.3f, 0.f, 0.f, 0.f, 0.f}, {0.31f, -0.02f, 0.05f, 0.04f, -0.03f, 0.06f},
+                                   {7.75f, 0.25f, 0.2f, 0.f, 0.f, 0.2f}, {0.f, 1.f, 0.f, 0.f, 0.f, 0.f}};
+  color3 laneColors[texture_lanes];
+  bool lanesOk = textureLevels(lanesTex) != NULL;
+  if (lanesOk) sampleTextureLanes(lanesTex, lanes, laneColors);
+  for (size_t i = 0; lanesOk && i < texture_lanes; ++i) lanesOk = length(laneColors[i] - sampleTexture(lanesTex, lanes[i])) < 1e-6f;
+  validTest("texture lanes", lanesOk, true);
+  freeTexture(lanesTex);
+  remove("unit-test-lanes.ppm");
+
+  //every level gives back the texels, over several stripes
+  size_t pngWidth = 512, pngHeight = 256;
+  std::vector<unsigned char> pngTexels(pngWidth * pngHeight * 3), stored, fast, best;
+  for (size_t i = 0; i < pngTexels.size(); ++i) pngTexels[i] = (unsigned char)((i / 3 % pngWidth) ^ (i / 3 / pngWidth) * (i % 3 + 1));
+  encodePNG(&stored, pngTexels.data(), pngWidth, pngHeight, png_stored);
+  encodePNG(&fast, pngTexels.data(), pngWidth, pngHeight, png_fast);
+  encodePNG(&best, pngTexels.data(), pngWidth, pngHeight, png_best);
+  bool pngOk = stored.size() > fast.size() && fast.size() >= best.size();
+  for (const std::vector<unsigned char> *png : {&stored, &fast, &best}) {
+    unsigned char *decoded = NULL;
+    unsigned w, h;
+    pngOk &= lodepng_decode24(&decoded, &w, &h, png->data(), png->size()) == 0 && w == pngWidth && h == pngHeight
+             && memcmp(decoded, pngTexels.data(), pngTexels.size()) == 0;
+    free(decoded);
+  }
+  validTest("png levels", pngOk, true);
+  std::vector<unsigned char> empty;
+  validTest("empty png", !encodePNG(&empty, pngTexels.data(), pngWidth, 0) && !encodePNG(&empty, pngTexels.data(), 0, pngHeight)
+            && empty.empty(), true);
+
+  //tiles hide behind texelAt, whatever the size
+  Image *gradient = initImage(7, 5);
+  for (size_t i = 0; i < 7*5; ++i) gradient->data[i] = color3(float(i));
+  MipChain *tiled = initMipChain(gradient);
+  bool tiledOk = tiled->levels.size() == 3 && tiled->levels[2].width == 1 && tiled->levels[1].height == 2;
+  for (size_t y = 0; y < 5; ++y)
+    for (size_t x = 0; x < 7; ++x)
+      tiledOk &= texelAt(tiled->levels[0], x, y) == gradient->data[y*7 + x];
+  validTest("tiled texels", tiledOk, true);
+  freeMipChain(tiled);
+  freeImage(gradient);
+
+  //every finite half goes through float and back, the others round to the nearest one
+  bool halfOk = floatToHalf(1.f/3.f) == 0x3555 && floatToHalf(1e-7f) == 0x0002 && floatToHalf(70000.f) == 0x7c00;
+  for (unsigned h = 0; h < 0x10000; ++h)
+    if ((h & 0x7c00) != 0x7c00) halfOk &= floatToHalf(halfToFloat(uint16_t(h))) == h;
+  validTest("half floats", halfOk, true);
+
+  //8 bit texels stay 8 bit, 4 bytes each with the level below
+  unsigned char bytes[2*2*3] = {0, 64, 255,  128, 64, 255,  255, 64, 255,  255, 64, 0};
+  MipChain *packed = initMipChainBytes(bytes, 2, 2);
+  validTest("8 bit texels", packed->levels[0].format == TEXEL_RGB8 && texelAt(packed->levels[0], 1, 0) == color3(128.f/255.f, 64.f/255.f, 1.f)
+            && texelAt(packed->levels[1], 0, 0) == color3(160.f/255.f, 64.f/255.f, 191.f/255.f) && mipChainSize(packed) == 2*64*16*4, true);
+  freeMipChain(packed);
+
+  //colors exact in 5:6:5 come back from blocks, normals keep their direction
+  unsigned char twoColors[4*4*3], flatNormals[4*4*3];
+  for (size_t i = 0; i < 16; ++i) {
+    unsigned char *c = twoColors + 3*i, *n = flatNormals + 3*i;
+    c[0] = (i & 1) ? 255 : 0; c[1] = 0; c[2] = (i & 1) ? 0 : 255;
+    n[0] = 128; n[1] = (i & 2) ? 100 : 128; n[2] = 255;
+  }
+  MipChain *colorBlocks = initMipChainBytes(twoColors, 4, 4), *normalBlocks = initMipChainBytes(flatNormals, 4, 4);
+  compressMipChain(colorBlocks, TEXTURE_COLOR_BLOCKS);
+  compressMipChain(normalBlocks, TEXTURE_NORMAL_BLOCKS);
+  vec3 tilted = texelAt(normalBlocks->levels[0], 2, 0), expectedTilt = normalize(vec3(128.f/255.f - 0.5f, 100.f/255.f - 0.5f, 1.f));
+  validTest("color blocks", colorBlocks->levels[0].format == TEXEL_BC1 && texelAt(colorBlocks->levels[0], 1, 2) == color3(1,0,0)
+            && texelAt(colorBlocks->levels[0], 2, 3) == color3(0,0,1) && mipChainSize(colorBlocks) == 3*64*8, true);
+  validTest("normal blocks", normalBlocks->levels[0].format == TEXEL_BC5 && abs(length(tilted) - 1.f) < 0.01f
+            && abs(tilted.y - expectedTilt.y) < 0.005f && mipChainSize(normalBlocks) == 3*64*16, true);
+  freeMipChain(colorBlocks);
+  freeMipChain(normalBlocks);
+
+  //normal and roughness maps are read as the shading uses them
+  unsigned char mapColors[3*3] = {128, 100, 255,  255, 255, 255,  0, 0, 0};
+  MipChain *unitNormals = initMipChainBytes(mapColors, 3, 1), *roughness = initMipChainBytes(mapColors, 3, 1);
+  compressMipChain(unitNormals, TEXTURE_UNIT_NORMALS);
+  compressMipChain(roughness, TEXTURE_ROUGHNESS);
+  validTest("unit normals", unitNormals->levels[0].format == TEXEL_OCT16 && length(texelAt(unitNormals->levels[0], 0, 0) - expectedTilt) < 1e-4f
+            && length(texelAt(unitNormals->levels[0], 2, 0) - vec3(-sqrtf(0.5f), -sqrtf(0.5f), 0.f)) < 1e-4f, true);
+  validTest("roughness map", roughness->levels[0].format == TEXEL_R16F && abs(texelAt(roughness->levels[0], 1, 0).x - 0.1f) < 1e-4f
+            && abs(texelAt(roughness->levels[0], 2, 0).y - 0.7f) < 1e-3f && mipChainSize(roughness) == 2*64*16*2, true);
+  freeMipChain(unitNormals);
+  freeMipChain(roughness);
+  //bump and roughness maps read as colors shade as the preprocessed ones do
+  FILE *bumpPpm = fopen("unit-test-bump.ppm", "w");
+  fprintf(bumpPpm, "P3\n1 1\n255\n128 100 255\n");
+  fclose(bumpPpm);
+  Material bumpy = dummy;
+  bumpy.hasBumpTexture = true;
+  bumpy.hasRoughTexture = true;
+  Intersection bumped[2];
+  float roughAlpha[2];
+  Texture *bumpMaps[2] = {initTexture("unit-test-bump.ppm"), initTexture("unit-test-bump.ppm", TEXTURE_UNIT_NORMALS)};
+  Texture *roughMaps[2] = {initTexture("unit-test-bump.ppm"), initTexture("unit-test-bump.ppm", TEXTURE_ROUGHNESS)};
+  for (int i = 0; i < 2; ++i) {
+    bumpy.bump_texture = bumpMaps[i];
+    bumpy.rough_texture = roughMaps[i];
+    bumped[i].mat = &bumpy;
+    bumped[i].hasTexCoord = true;
+    bumped[i].texCoord = {0.5f, 0.5f, 0.f, 0.f, 0.f, 0.f};
+    bumped[i].baseNormal = vec3(0.f, 0.f, 1.f);
+    applyBumpTexSphere(&bumped[i]);
+    roughAlpha[i] = applyRoughTexObject(bumped[i]);
+  }
+  float expectedAlpha = 0.1f / ((128.f + 100.f + 255.f) / (3.f * 255.f));
+  validTest("bump map as colors", length(bumped[0].normal - expectedTilt) < 1e-3f && length(bumped[1].normal - expectedTilt) < 1e-3f, true);
+  validTest("roughness map as colors", abs(roughAlpha[0] - expectedAlpha) < 1e-4f && abs(roughAlpha[1] - expectedAlpha) < 1e-3f, true);
+  for (int i = 0; i < 2; ++i) {
+    freeTexture(bumpMaps[i]);
+    freeTexture(roughMaps[i]);
+  }
+  purgeAssets();
+  remove("unit-test-bump.ppm");
+
+  //a paged copy reads the same texels, through a cache smaller than the texture
+  std::vector<unsigned char> noise(80*40*3);
+  for (size_t i = 0; i < noise.size(); ++i) noise[i] = (unsigned char)(i * 37 % 251);
+  MipChain *resident = initMipChainBytes(noise.data(), 80, 40);
+  setTextureCacheCapacity(4096);
+  MipChain *paged = writeMipChainCache("unit-test.mrttex", resident) ? loadMipChainCache("unit-test.mrttex") : NULL;
+  bool pagedOk = paged != NULL && paged->levels.size() == resident->levels.size();
+  for (size_t l = 0; pagedOk && l < paged->levels.size(); ++l) {
+    const TextureLevel &a = resident->levels[l], &b = paged->levels[l];
+    for (size_t y = 0; y < a.height; ++y)
+      for (size_t x = 0; x < a.width; ++x)
+        pagedOk &= b.texels == NULL && texelAt(a, x, y) == texelAt(b, x, y);
+  }
+  TextureCacheStats cacheStats = textureCacheStats();
+  validTest("paged texture", pagedOk && cacheStats.size <= 4096 && cacheStats.misses >= 13 && cacheStats.bytesRead == cacheStats.misses * 4096
+            && cacheStats.lookups > cacheStats.misses, true);
+  if (paged) freeMipChain(paged);
+  freeMipChain(resident);
+  setTextureCacheCapacity(0);
+  remove("unit-test.mrttex");
+
+  //a cached mesh maps back to the same levels
+  Mesh *built = initMesh(), *cached = initMesh();
+  buildMeshLods(built, &bigObj);
+  bool cacheOk = writeMeshCache("unit-test.mrtmesh", built) && loadMeshCache("unit-test.mrtmesh", cached)
+                 && cached->lods.size() == built->lods.size() && cached->bmax == built->bmax && cached->storage.empty();
+  for (size_t i = 0 ; cacheOk && i < built->lods.size() ; ++i) {
+    const MeshLod &a = built->lods[i], &b = cached->lods[i];
+    cacheOk = a.vertexCount == b.vertexCount && a.triangleCount == b.triangleCount && a.quadCount == b.quadCount
+              && memcmp(a.positions, b.positions, a.vertexCount * 3 * sizeof(uint16_t)) == 0
+              && memcmp(a.triangles, b.triangles, a.triangleCount * 3 * sizeof(unsigned)) == 0
+              && memcmp(a.quads, b.quads, a.quadCount * 4 * sizeof(unsigned)) == 0;
+  }
+  validTest("mesh cache", cacheOk, true);
+  //a cache with a corner past the vertices is rejected, the mesh is then parsed again
+  bool corruptRejected = false;
+  FILE *cacheFile = fopen("unit-test.mrtmesh", "r+b");
+  const MeshLod &level0 = built->lods[0];
+  if (cacheFile && level0.triangleCount + level0.quadCount > 0) {
+    std::vector<char> cacheBytes(1 << 20);
+    cacheBytes.resize(fread(cacheBytes.data(), 1, cacheBytes.size(), cacheFile));
+    const char *corners = (const char *)(level0.triangleCount > 0 ? level0.triangles : level0.quads);
+    auto found = std::search(cacheBytes.begin(), cacheBytes.end(), corners, corners + 3 * sizeof(unsigned));
+    if (found != cacheBytes.end()) {
+      unsigned past = unsigned(level0.vertexCount);
+      fseek(cacheFile, long(found - cacheBytes.begin()), SEEK_SET);
+      fwrite(&past, sizeof(past), 1, cacheFile);
+      fflush(cacheFile);
+      Mesh *corrupt = initMesh();
+      corruptRejected = !loadMeshCache("unit-test.mrtmesh", corrupt);
+      freeMesh(corrupt);
+    }
+  }
+  if (cacheFile) fclose(cacheFile);
+  validTest("corrupt mesh cache", corruptRejected, true);
+  freeMesh(built);
+  freeMesh(cached);
+  remove("unit-test.mrtmesh");
+  float parsed = 0.f;
+  const char *number = "-12.5e-2x";
+  validTest("parse float", parseFloat(number, number + 9, &parsed) == number + 8 && parsed == -0.125f, true);
 
   bool beckmann=true;
   for(int i=0; i<beckmannExpectedCount; i++){